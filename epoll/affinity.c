@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "debug.h"
+#include "common.h"
+#include "affinity.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+#define SYSFS_NET "/sys/class/net"
+
+int parse_cpu_list(const char *str, cpu_list_t *l) {
+	long first, last;
+	char *end;
+
+	l->nb = 0;
+	do {
+		first = last = strtol(str, &end, 10);
+		if (end == str) return FALSE;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str) return FALSE;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE) return FALSE;
+		for (long cpu = first; cpu <= last; cpu++) {
+			if (l->nb == MAX_CPU_LIST) return FALSE;
+			l->cpus[l->nb++] = cpu;
+		}
+		str = end + 1;
+	} while (*end == ',');
+	return *end == '\0';
+}
+
+int pin_thread(const cpu_list_t *l, int i) {
+	cpu_set_t set;
+	int cpu;
+
+	if (l->nb == 0) return TRUE;
+	cpu = l->cpus[i % l->nb];
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+		TRACE_ERROR("Unable to pin a thread to CPU %d, error: %s\n", cpu, strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// The cpuN directory links the node it belongs to as nodeM
+int cpu_node(int cpu) {
+	char path[64];
+	DIR *dir;
+	struct dirent *e;
+	int node = -1;
+
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d", cpu);
+	dir = opendir(path);
+	if (dir == NULL) return -1;
+	while ((e = readdir(dir)) != NULL) {
+		if (strncmp(e->d_name, "node", 4) == 0 && sscanf(e->d_name + 4, "%d", &node) == 1)
+			break;
+	}
+	closedir(dir);
+	return node;
+}
+
+int bind_local(void *addr, size_t len) {
+	unsigned int cpu, node;
+	unsigned long mask;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == -1) return FALSE;
+	if (node >= sizeof(mask) * 8) return FALSE;
+	mask = 1UL << node;
+	// The kernel only looks at the first maxnode - 1 bits
+	if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0) == -1) {
+		TRACE_ERROR("Unable to bind memory to node %d, error: %s\n", node, strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Formats the set as a list like 0-3,8
+static void format_cpus(const cpu_set_t *set, char *buf, size_t len) {
+	int first, n = 0;
+
+	buf[0] = '\0';
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, set)) continue;
+		for (first = cpu; cpu + 1 < CPU_SETSIZE && CPU_ISSET(cpu + 1, set); cpu++)
+			;
+		if (first == cpu) n += snprintf(buf + n, len > n ? len - n : 0, "%s%d", n ? "," : "", cpu);
+		else n += snprintf(buf + n, len > n ? len - n : 0, "%s%d-%d", n ? "," : "", first, cpu);
+	}
+	if (n == 0) snprintf(buf, len, "none");
+}
+
+void describe_placement(char *buf, size_t len) {
+	cpu_set_t set;
+	char cpus[256];
+	int node, n = -2;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+		snprintf(buf, len, "unknown");
+		return;
+	}
+	// The node if they are all on the same one
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &set)) continue;
+		node = cpu_node(cpu);
+		if (n == -2) n = node;
+		else if (n != node) n = -1;
+	}
+	format_cpus(&set, cpus, sizeof(cpus));
+	if (n >= 0) snprintf(buf, len, "CPUs %s, node %d", cpus, n);
+	else snprintf(buf, len, "CPUs %s, any node", cpus);
+}
+
+// Adds a hex mask like 00000000,000000ff to the set, the last group of
+// digits holds the first CPUs
+static void parse_mask(const char *str, cpu_set_t *set) {
+	int cpu = 0, digit;
+
+	for (const char *c = str + strlen(str) - 1; c >= str; c--) {
+		if (*c == ',' || *c == '\n') continue;
+		if (*c >= '0' && *c <= '9') digit = *c - '0';
+		else if (*c >= 'a' && *c <= 'f') digit = *c - 'a' + 10;
+		else continue;
+		for (int b = 0; b < 4; b++, cpu++) {
+			if ((digit & (1 << b)) && cpu < CPU_SETSIZE) CPU_SET(cpu, set);
+		}
+	}
+}
+
+// Whether the interrupt line names the interface or device itself, not
+// one whose name only starts the same, eth1 is not eth10-TxRx-0
+static int names(const char *line, const char *name) {
+	size_t len = strlen(name);
+	const char *p = line;
+	char next;
+
+	while ((p = strstr(p, name)) != NULL) {
+		next = p[len];
+		if (next == '-' || next == '.' || next == '\0' || isspace((unsigned char)next)) return TRUE;
+		p++;
+	}
+	return FALSE;
+}
+
+// Interrupt lines are named after the interface or its device, e.g.
+// eth0-TxRx-0 or virtio0-input.0
+static void irq_cpus(const char *ifname, const char *dev, cpu_set_t *set) {
+	FILE *f, *aff;
+	char line[1024], path[64], cpus[1024];
+	cpu_list_t l;
+	int irq;
+
+	f = fopen("/proc/interrupts", "r");
+	if (f == NULL) return;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, " %d:", &irq) != 1) continue;
+		if (!names(line, ifname) && (dev[0] == '\0' || !names(line, dev))) continue;
+
+		snprintf(path, sizeof(path), "/proc/irq/%d/effective_affinity_list", irq);
+		aff = fopen(path, "r");
+		if (aff == NULL) {
+			snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+			aff = fopen(path, "r");
+		}
+		if (aff == NULL) continue;
+		if (fgets(cpus, sizeof(cpus), aff)) {
+			cpus[strcspn(cpus, "\n")] = '\0';
+			if (parse_cpu_list(cpus, &l)) {
+				for (int i = 0; i < l.nb; i++) CPU_SET(l.cpus[i], set);
+			}
+		}
+		fclose(aff);
+	}
+	fclose(f);
+}
+
+static void rps_cpus(const char *ifname, cpu_set_t *set) {
+	char path[PATH_MAX], mask[1024];
+	DIR *dir;
+	FILE *f;
+	struct dirent *e;
+
+	snprintf(path, sizeof(path), SYSFS_NET "/%s/queues", ifname);
+	dir = opendir(path);
+	if (dir == NULL) return;
+	while ((e = readdir(dir)) != NULL) {
+		if (strncmp(e->d_name, "rx-", 3) != 0) continue;
+		snprintf(path, sizeof(path), SYSFS_NET "/%s/queues/%s/rps_cpus", ifname, e->d_name);
+		f = fopen(path, "r");
+		if (f == NULL) continue;
+		if (fgets(mask, sizeof(mask), f)) parse_mask(mask, set);
+		fclose(f);
+	}
+	closedir(dir);
+}
+
+void print_irq_hints(const char *ifname, const cpu_list_t *l) {
+	char path[PATH_MAX], link[PATH_MAX], dev[NAME_MAX + 1] = "";
+	char irqs[256], rps[256], where[32];
+	cpu_set_t irq_set, rps_set;
+	FILE *f;
+	ssize_t n;
+	int cpu, node = -1, cnode;
+
+	snprintf(path, sizeof(path), SYSFS_NET "/%s", ifname);
+	if (access(path, F_OK) == -1) {
+		TRACE_ERROR("There is no interface called %s\n", ifname);
+		return;
+	}
+
+	snprintf(path, sizeof(path), SYSFS_NET "/%s/device", ifname);
+	n = readlink(path, link, sizeof(link) - 1);
+	if (n > 0) {
+		link[n] = '\0';
+		snprintf(dev, sizeof(dev), "%s", basename(link));
+	}
+	snprintf(path, sizeof(path), SYSFS_NET "/%s/device/numa_node", ifname);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%d", &node) != 1) node = -1;
+		fclose(f);
+	}
+
+	CPU_ZERO(&irq_set);
+	CPU_ZERO(&rps_set);
+	irq_cpus(ifname, dev, &irq_set);
+	rps_cpus(ifname, &rps_set);
+	format_cpus(&irq_set, irqs, sizeof(irqs));
+	format_cpus(&rps_set, rps, sizeof(rps));
+	if (node >= 0) snprintf(where, sizeof(where), "node %d", node);
+	else snprintf(where, sizeof(where), "unknown node");
+	TRACE_INFO("%s: %s | Interrupts on CPUs %s | RPS on CPUs %s\n", ifname, where, irqs, rps);
+
+	for (int i = 0; i < l->nb; i++) {
+		cpu = l->cpus[i];
+		if (CPU_ISSET(cpu, &irq_set))
+			TRACE_INFO("CPU %d also takes the interrupts of %s\n", cpu, ifname);
+		if (CPU_ISSET(cpu, &rps_set))
+			TRACE_INFO("CPU %d also does receive packet steering for %s\n", cpu, ifname);
+		cnode = cpu_node(cpu);
+		if (node >= 0 && cnode >= 0 && cnode != node)
+			TRACE_INFO("CPU %d is on node %d, traffic of %s on node %d crosses sockets\n",
+						cpu, cnode, ifname, node);
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+#include <stddef.h>
+
+// Placement of the threads on CPUs and of their memory on NUMA nodes
+
+#define MAX_CPU_LIST (1024)
+
+// CPUs in the order the threads are put on them, the i-th thread goes on
+// cpus[i % nb]
+typedef struct cpu_list {
+	int cpus[MAX_CPU_LIST];
+	int nb;
+} cpu_list_t;
+
+// Parses a list like 0-3,8,10-11
+int parse_cpu_list(const char *str, cpu_list_t *l);
+
+// Pins the calling thread to the CPU of the i-th thread, does nothing on
+// an empty list
+int pin_thread(const cpu_list_t *l, int i);
+
+// NUMA node of the CPU, -1 if the system doesn't tell
+int cpu_node(int cpu);
+
+// Makes the pages of [addr, addr + len) come from the NUMA node the caller
+// runs on, as long as it has free memory. Has to be called before they
+// are touched.
+int bind_local(void *addr, size_t len);
+
+// Where the calling thread may run, e.g. "CPUs 2-3, node 0"
+void describe_placement(char *buf, size_t len);
+
+// Prints the NUMA node of the interface and the CPUs its interrupts and
+// RPS go to, and warns about the CPUs of the list that share them or sit
+// on another node
+void print_irq_hints(const char *ifname, const cpu_list_t *l);
+
+#endif /* AFFINITY_H_ */
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "batch.h"
+
+int batch_init(batch_t *b, bufpool_t *pool, size_t cap) {
+	memset(b, 0, sizeof(batch_t));
+	b->buf = bufpool_get(pool, cap, &b->buf_cap);
+	if (b->buf == NULL) return FALSE;
+	b->cap = cap;
+	return TRUE;
+}
+
+void batch_free(batch_t *b, bufpool_t *pool) {
+	if (b->buf) bufpool_put(pool, b->buf, b->buf_cap);
+	b->buf = NULL;
+}
+
+void batch_add(batch_t *b, const uint8_t *msg, size_t len, uint16_t stream) {
+	uint32_t hdr = htonl(len);
+
+	if (b->msgs == 0) {
+		b->stream = stream;
+		b->first_ts = nano_ts();
+	}
+	memcpy(b->buf + b->len, &hdr, BATCH_HDR);
+	memcpy(b->buf + b->len + BATCH_HDR, msg, len);
+	b->len += BATCH_HDR + len;
+	b->msgs++;
+}
+
+size_t unbatch_next(unbatch_t *u, const uint8_t **data, size_t *len,
+					const uint8_t **piece, int *end) {
+	size_t n;
+	uint32_t hdr;
+
+	while (u->left == 0) {
+		if (*len == 0) return 0;
+		n = MIN(*len, BATCH_HDR - u->hdr_len);
+		memcpy(u->hdr + u->hdr_len, *data, n);
+		u->hdr_len += n;
+		*data += n;
+		*len -= n;
+		if (u->hdr_len < BATCH_HDR) return 0;
+
+		memcpy(&hdr, u->hdr, BATCH_HDR);
+		u->left = ntohl(hdr);
+		u->hdr_len = 0;
+	}
+	if (*len == 0) return 0;
+
+	n = MIN(*len, u->left);
+	*piece = *data;
+	*data += n;
+	*len -= n;
+	u->left -= n;
+	*end = u->left == 0;
+	return n;
+}
@@ -0,0 +1,59 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "timing.h"
+#include "bufpool.h"
+
+// Small messages packed into one SCTP message, every one of them behind
+// its length as a 32 bit integer in network byte order
+#define BATCH_HDR (sizeof(uint32_t))
+#define MAX_BATCH (64 * 1024)
+
+typedef struct batch {
+	uint8_t *buf;
+	size_t len;
+	// Bytes that go in it, and the size of the buffer
+	size_t cap;
+	size_t buf_cap;
+	// Messages in it, the stream of the first one is the one it goes on
+	int msgs;
+	uint16_t stream;
+	// When the first message went in
+	nano_ts_t first_ts;
+} batch_t;
+
+// Where the reader is in the batches coming in on one stream, a batch
+// may be read in pieces that split a message or its length
+typedef struct unbatch {
+	// Bytes of the current message still to come, 0 while reading a length
+	size_t left;
+	uint8_t hdr[BATCH_HDR];
+	size_t hdr_len;
+} unbatch_t;
+
+// The buffer comes from the pool, of at least cap bytes
+int batch_init(batch_t *b, bufpool_t *pool, size_t cap);
+void batch_free(batch_t *b, bufpool_t *pool);
+
+static inline int batch_fits(batch_t *b, size_t len) {
+	return b->len + BATCH_HDR + len <= b->cap;
+}
+
+// Appends a message, the caller checks that it fits first
+void batch_add(batch_t *b, const uint8_t *msg, size_t len, uint16_t stream);
+
+static inline void batch_reset(batch_t *b) {
+	b->len = 0;
+	b->msgs = 0;
+}
+
+// Takes the next piece of a message out of the len bytes at data and
+// moves data past it. Returns the length of the piece, with end set if it
+// completes the message, or 0 once all of data is used up.
+size_t unbatch_next(unbatch_t *u, const uint8_t **data, size_t *len,
+					const uint8_t **piece, int *end);
+
+#endif /* BATCH_H_ */
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Opens and closes associations in a loop with the storm mode of the
+# client, the way clients reconnect after a failover, against every number
+# of accept threads in ACCEPTORS (0 accepts on the main thread) and every
+# listen backlog in BACKLOGS. Prints the associations per second, the
+# handshake time percentiles and the handshakes that failed, which is
+# where a backlog that is too short shows up.
+#
+# usage: bench/accept.sh [handshakes in flight] [client threads] [seconds] [reactors]
+# Run from the epoll directory after make, client and server on this host.
+
+CONCURRENCY=${1:-64}
+THREADS=${2:-4}
+DURATION=${3:-10}
+REACTORS=${4:-2}
+ACCEPTORS=${ACCEPTORS:-"0 1 2 4"}
+BACKLOGS=${BACKLOGS:-"100 1024 4096"}
+ADDR=127.0.0.1
+
+printf "%-10s %-8s %-12s %-10s %-10s %-10s %s\n" \
+	acceptors backlog assocs/s p50_us p99_us p99.9_us failed
+for acceptors in $ACCEPTORS; do
+	for backlog in $BACKLOGS; do
+		./build/server -i 0 -r $REACTORS -a $acceptors -L $backlog > /tmp/sctp_bench_server.log 2>&1 &
+		server=$!
+		sleep 1
+		timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -E -n $CONCURRENCY -t $THREADS \
+			> /tmp/sctp_bench_client.log 2>&1
+		kill -INT $server
+		wait $server
+
+		summary=$(grep 'Associations per second: ' /tmp/sctp_bench_client.log)
+		hist=$(grep 'Handshakes: ' /tmp/sctp_bench_client.log)
+		printf "%-10s %-8s %-12s %-10s %-10s %-10s %s\n" $acceptors $backlog \
+			$(echo "$summary" | grep -o 'Associations per second: [0-9.]*' | grep -o '[0-9.]*$') \
+			$(echo "$hist" | grep -o 'p50: [0-9.]*' | grep -o '[0-9.]*$') \
+			$(echo "$hist" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$') \
+			$(echo "$hist" | grep -o 'p99.9: [0-9.]*' | grep -o '[0-9.]*$') \
+			$(echo "$summary" | grep -o 'Failed handshakes: [0-9]*' | grep -o '[0-9]*$')
+	done
+done
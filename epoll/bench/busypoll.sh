@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+# Round trip time of small messages with the server reactor blocking in
+# epoll_wait, spinning for a budget before it blocks, and spinning with
+# SO_BUSY_POLL on top. Server and client are pinned to cores of their own,
+# as for latency critical signalling on dedicated cores. Every mode runs
+# closed loop with one message in flight and open loop at RATE messages
+# per second, where the reactor goes idle between messages.
+#
+# usage: bench/busypoll.sh [server cpu] [client cpu] [seconds] [rate] [busy poll us]
+# Run from the epoll directory after make, client and server on this host.
+
+SERVER_CPU=${1:-2}
+CLIENT_CPU=${2:-3}
+DURATION=${3:-10}
+RATE=${4:-10000}
+BUSY_POLL=${5:-50}
+CLIENTS=4
+ADDR=127.0.0.1
+
+run() {
+	local name=$1 load=$2 server_opts=$3
+	shift 3
+
+	taskset -c $SERVER_CPU ./build/server -i 0 -r 1 $server_opts > /tmp/sctp_bench_server.log 2>&1 &
+	local server=$!
+	sleep 1
+	timeout -s INT $DURATION taskset -c $CLIENT_CPU ./build/client -i 0 -a $ADDR -t 1 \
+		-n $CLIENTS -l 64 $@ > /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	all=$(grep 'All streams: ' /tmp/sctp_bench_client.log)
+	printf "%-8s %-14s %-12s %-10s %-10s %-10s %-10s %s\n" $load $name \
+		$(grep -o 'Messages per second: [0-9.]*' /tmp/sctp_bench_client.log | tail -1 | grep -o '[0-9.]*$') \
+		$(echo "$all" | grep -o 'p50: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$all" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$all" | grep -o 'p99.9: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(grep -o 'Caught spinning: [0-9.]*' /tmp/sctp_bench_server.log | grep -o '[0-9.]*$' || echo -) \
+		$(grep -o 'Sleeps per message: [0-9.]*' /tmp/sctp_bench_server.log | grep -o '[0-9.]*$' || echo -)
+}
+
+printf "%-8s %-14s %-12s %-10s %-10s %-10s %-10s %s\n" \
+	load mode msgs/s p50_us p99_us p99.9_us spin_hit% sleeps/msg
+for load in closed open; do
+	if [ $load = closed ]; then opts="-w 1"; else opts="-w 1 -R $RATE"; fi
+	run blocking $load "" $opts
+	run spin-20us $load "-B 20" $opts
+	run spin-200us $load "-B 200" $opts
+	run spin+busy $load "-B 200:$BUSY_POLL" $opts
+done
@@ -0,0 +1,46 @@
+#!/bin/bash
+#
+# Echoes 64 and 256 byte messages and prints the messages per second and
+# the round trip time with the stack bundling them (default), with
+# SCTP_NODELAY, and with the client packing them into batches of BATCH
+# bytes, written right away or after DELAY microseconds. The server
+# echoes a batch as one message.
+#
+# usage: bench/coalesce.sh [window] [clients] [seconds] [batch bytes] [delay us]
+# Run from the epoll directory after make, client and server on this host.
+
+WINDOW=${1:-32}
+CLIENTS=${2:-10}
+DURATION=${3:-10}
+BATCH=${4:-4096}
+DELAY=${5:-100}
+ADDR=127.0.0.1
+
+run() {
+	local name=$1 size=$2 server_opts=$3
+	shift 3
+
+	./build/server -i 0 $server_opts > /dev/null 2>&1 &
+	local server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW -l $size $@ \
+		> /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	all=$(grep 'All streams: ' /tmp/sctp_bench_client.log)
+	printf "%-6s %-16s %-14s %-12s %-12s %s\n" $size $name \
+		$(grep -o 'Messages per second: [0-9.]*' /tmp/sctp_bench_client.log | tail -1 | grep -o '[0-9.]*$') \
+		$(echo "$all" | grep -o 'p50: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$all" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(grep -o 'Messages per batch: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+}
+
+printf "%-6s %-16s %-14s %-12s %-12s %s\n" size mode msgs/s p50_us p99_us per_batch
+for size in 64 256; do
+	run bundled $size ""
+	run nodelay $size "-N" -N
+	run batch $size "" -b $BATCH
+	run batch+delay $size "" -b $BATCH:$DELAY
+	run batch+nodelay $size "-N" -b $BATCH -N
+done
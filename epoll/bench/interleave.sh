@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# Sends large bulk messages alongside small control messages and prints
+# the round trip time of the control messages with and without message
+# interleaving (I-DATA). Without it a control message waits for every
+# fragment of the bulk message ahead of it. Needs root to turn on
+# net.sctp.intl_enable.
+#
+# usage: bench/interleave.sh [bulk size] [control every n] [streams] [window] [clients] [seconds]
+# Run from the epoll directory after make, client and server on this host.
+
+SIZE=${1:-262144}
+EVERY=${2:-4}
+STREAMS=${3:-4}
+WINDOW=${4:-4}
+CLIENTS=${5:-10}
+DURATION=${6:-10}
+ADDR=127.0.0.1
+
+intl=$(sysctl -n net.sctp.intl_enable) || exit 1
+sysctl -q -w net.sctp.intl_enable=1 || exit 1
+trap "sysctl -q -w net.sctp.intl_enable=$intl" EXIT
+
+run() {
+	local name=$1
+	shift
+
+	./build/server -i 0 -s $STREAMS $@ > /dev/null 2>&1 &
+	local server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW -s $STREAMS \
+		-c $EVERY -l $SIZE $@ > /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	control=$(grep 'Control: ' /tmp/sctp_bench_client.log)
+	bulk=$(grep 'Bulk: ' /tmp/sctp_bench_client.log)
+	printf "%-12s %-14s %-14s %-14s %s\n" $name \
+		$(echo "$control" | grep -o 'p50: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$control" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$control" | grep -o 'p99.9: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$bulk" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$')
+}
+
+echo "$SIZE byte bulk messages, every ${EVERY}th message is a control message"
+printf "%-12s %-14s %-14s %-14s %s\n" mode control_p50 control_p99 control_p99.9 bulk_p99
+run fragments
+run interleaved -I
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Compares the one-to-one (stream) and one-to-many (seqpacket) socket models
+# at several association counts. For every run it samples the server's
+# resident memory, open fds and the kernel socket memory while the load is
+# running, then prints the messages per second reported by the server.
+#
+# usage: bench/models.sh [seconds] [association counts...]
+# Run from the epoll directory after make, client and server on this host.
+
+DURATION=${1:-10}
+shift
+COUNTS=${@:-10 1000 10000}
+ADDR=127.0.0.1
+
+# One fd per association on both ends in the one-to-one model
+ulimit -n 65536 2> /dev/null
+
+# Kernel memory charged to SCTP sockets, in pages
+sctp_mem() {
+	awk '/^SCTP:/ { for (i = 1; i < NF; i++) if ($i == "mem") print $(i + 1) }' \
+		/proc/net/sockstat
+}
+
+run() {
+	local model=$1 count=$2
+
+	./build/server -i 0 -m $model 2> /tmp/sctp_bench_server.log &
+	local server=$!
+	sleep 1
+	./build/client -a $ADDR -n $count > /dev/null 2>&1 &
+	local client=$!
+
+	# Let every association come up before sampling
+	sleep $((DURATION / 2))
+	local rss=$(awk '/VmRSS/ { print $2 }' /proc/$server/status)
+	local fds=$(ls /proc/$server/fd | wc -l)
+	local kmem=$(sctp_mem)
+	sleep $((DURATION - DURATION / 2))
+
+	kill -INT $client
+	wait $client
+	kill -INT $server
+	wait $server
+
+	printf "%-10s %6d assocs | RSS %8d KiB | %6d fds | SCTP mem %6s pages | %s\n" \
+		$model $count $rss $fds "${kmem:-?}" \
+		"$(grep -o 'Messages per second.*' /tmp/sctp_bench_server.log)"
+}
+
+for count in $COUNTS; do
+	run stream $count
+	run seqpacket $count
+done
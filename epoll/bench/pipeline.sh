@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# Echoes messages through the pipeline mode of the server for every mix of
+# reactors and workers in REACTORS and WORKERS and every per message work
+# cost in COSTS (nanoseconds), and prints the messages per second, the
+# round trip time and how long the messages spent on the rings to and from
+# the workers. 0 workers echoes inline on the reactors, as the baseline.
+# The handoff dominates once the time on the rings outgrows the work.
+#
+# usage: bench/pipeline.sh [window] [clients] [seconds] [message size]
+# Run from the epoll directory after make, client and server on this host.
+
+WINDOW=${1:-16}
+CLIENTS=${2:-32}
+DURATION=${3:-10}
+SIZE=${4:-256}
+REACTORS=${REACTORS:-"1 2"}
+WORKERS=${WORKERS:-"0 1 2 4"}
+COSTS=${COSTS:-"0 1000 10000"}
+ADDR=127.0.0.1
+
+printf "%-8s %-8s %-8s %-12s %-10s %-10s %-10s %-10s %s\n" \
+	cost_ns reactors workers msgs/s p50_us p99_us to_us back_us stalls
+for cost in $COSTS; do
+	for reactors in $REACTORS; do
+		for workers in $WORKERS; do
+			# Inline echoes don't pay for any work
+			[ $workers = 0 ] && [ $cost != 0 ] && continue
+
+			./build/server -i 0 -r $reactors -W $workers -c $cost > /tmp/sctp_bench_server.log 2>&1 &
+			server=$!
+			sleep 1
+			timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW -l $SIZE \
+				> /tmp/sctp_bench_client.log 2>&1
+			kill -INT $server
+			wait $server
+
+			all=$(grep 'All streams: ' /tmp/sctp_bench_client.log)
+			handoff=$(grep 'Handoff: ' /tmp/sctp_bench_server.log)
+			printf "%-8s %-8s %-8s %-12s %-10s %-10s %-10s %-10s %s\n" $cost $reactors $workers \
+				$(grep -o 'Messages per second: [0-9.]*' /tmp/sctp_bench_client.log | tail -1 | grep -o '[0-9.]*$') \
+				$(echo "$all" | grep -o 'p50: [0-9.]*' | grep -o '[0-9.]*$') \
+				$(echo "$all" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$') \
+				$(echo "$handoff" | grep -o '[0-9.]*us to' | grep -o '^[0-9.]*' || echo -) \
+				$(echo "$handoff" | grep -o '[0-9.]*us back' | grep -o '^[0-9.]*' || echo -) \
+				$(grep -o 'Stalls on a full ring: [0-9]*' /tmp/sctp_bench_server.log | grep -o '[0-9]*$' || echo -)
+		done
+	done
+done
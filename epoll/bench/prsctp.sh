@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# Compares the round trip time under loss of the ordered, fully reliable
+# default with unordered and partially reliable (PR-SCTP) delivery. netem
+# drops packets on the loopback, both sides send with the same policy, and
+# every mode prints its percentiles along with the messages that never
+# came back. Needs root for tc.
+#
+# usage: bench/prsctp.sh [loss %] [ttl ms] [retransmissions] [window] [clients] [seconds]
+# Run from the epoll directory after make, client and server on this host.
+
+LOSS=${1:-1}
+TTL=${2:-50}
+RTX=${3:-1}
+WINDOW=${4:-16}
+CLIENTS=${5:-10}
+DURATION=${6:-10}
+ADDR=127.0.0.1
+DEV=lo
+
+tc qdisc add dev $DEV root netem loss ${LOSS}% || exit 1
+trap "tc qdisc del dev $DEV root" EXIT
+
+run() {
+	local name=$1
+	shift
+
+	./build/server -i 0 $@ > /dev/null 2>&1 &
+	local server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW $@ \
+		> /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	p50=$(grep -o 'p50: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	p99=$(grep -o 'p99: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	p999=$(grep -o 'p99.9: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	lost=$(grep -o 'Lost: [0-9]* ([0-9.]*%)' /tmp/sctp_bench_client.log | cut -d' ' -f2-)
+	printf "%-12s %-10s %-10s %-10s %s\n" $name $p50 $p99 $p999 "${lost:-0}"
+}
+
+echo "${LOSS}% loss, window of $WINDOW per association"
+printf "%-12s %-10s %-10s %-10s %s\n" mode p50_us p99_us p99.9_us lost
+run reliable
+run unordered -o
+run ttl -o -x ttl:$TTL
+run rtx -o -x rtx:$RTX
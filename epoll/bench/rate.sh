@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Runs the client open loop at increasing rates and prints the p99 round
+# trip time at each of them, stopping at the first rate that breaks the
+# p99 budget. The last rate that stayed within it is the highest rate the
+# server sustains under that budget.
+#
+# usage: bench/rate.sh [p99 budget in us] [clients] [seconds] [rates...]
+# Run from the epoll directory after make, client and server on this host.
+
+BUDGET=${1:-1000}
+CLIENTS=${2:-100}
+DURATION=${3:-10}
+shift $(( $# < 3 ? $# : 3 ))
+RATES=${@:-10000 20000 50000 100000 200000 500000 1000000}
+ADDR=127.0.0.1
+DIST=${DIST:-poisson}
+
+best=none
+printf "%-10s %-14s %-10s %s\n" rate msgs_per_sec p50_us p99_us
+for rate in $RATES; do
+	./build/server > /dev/null 2>&1 &
+	server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -R $rate -d $DIST \
+		> /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	msgs=$(grep -o 'Messages per second: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	p50=$(grep -o 'p50: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	p99=$(grep -o 'p99: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	printf "%-10s %-14s %-10s %s\n" $rate $msgs $p50 $p99
+
+	if awk -v p99=$p99 -v budget=$BUDGET 'BEGIN { exit !(p99 > budget) }'; then
+		break
+	fi
+	best=$rate
+done
+echo "Highest rate within a p99 of ${BUDGET}us: $best"
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Runs a bulk and control traffic mix under every kernel stream scheduler
+# and prints the round trip time of both classes. Control messages go on
+# stream 0, which prio gives the highest priority. The window has to be
+# deep enough to back the bulk messages up in the socket, or there is
+# nothing for the scheduler to reorder.
+#
+# usage: bench/sched.sh [streams] [control every n] [window] [clients] [seconds]
+# Run from the epoll directory after make, client and server on this host.
+
+STREAMS=${1:-4}
+EVERY=${2:-10}
+WINDOW=${3:-64}
+CLIENTS=${4:-10}
+DURATION=${5:-10}
+ADDR=127.0.0.1
+SCHEDS=${SCHEDS:-fcfs prio rr fc}
+
+# Stream 0 first, every bulk stream after it
+PRIO=prio:0$(printf ',1%.0s' $(seq 2 $STREAMS))
+
+printf "%-8s %-14s %-14s %-14s %s\n" sched control_p50 control_p99 bulk_p50 bulk_p99
+for sched in $SCHEDS; do
+	[ $sched = prio ] && sched=$PRIO
+	./build/server -i 0 -s $STREAMS -S $sched > /dev/null 2>&1 &
+	server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW -s $STREAMS \
+		-c $EVERY -S $sched > /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	control=$(grep 'Control: ' /tmp/sctp_bench_client.log)
+	bulk=$(grep 'Bulk: ' /tmp/sctp_bench_client.log)
+	printf "%-8s %-14s %-14s %-14s %s\n" ${sched%%:*} \
+		$(echo "$control" | grep -o 'p50: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$control" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$bulk" | grep -o 'p50: [0-9.]*' | grep -o '[0-9.]*$') \
+		$(echo "$bulk" | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$')
+done
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Echoes messages from 64 bytes up to 16 MiB and prints the throughput and
+# the peak memory of the server for every size. Messages that don't fit in
+# one read are put together in pooled buffers and echoed as one message.
+# Needs root to raise net.sctp.sctp_wmem and sctp_rmem so that a whole
+# message fits in the socket buffers.
+#
+# usage: bench/size.sh [window] [clients] [seconds] [server options]
+# Run from the epoll directory after make, client and server on this host.
+
+WINDOW=${1:-1}
+CLIENTS=${2:-4}
+DURATION=${3:-10}
+SERVER_OPTS=${4:-}
+ADDR=127.0.0.1
+SIZES="64 256 1024 4096 16384 65536 262144 1048576 4194304 16777216"
+# Room for a window of the largest messages
+BUF=$((64 * 1024 * 1024))
+
+wmem=$(sysctl -n net.sctp.sctp_wmem) || exit 1
+rmem=$(sysctl -n net.sctp.sctp_rmem) || exit 1
+sysctl -q -w net.sctp.sctp_wmem="4096 $BUF $BUF" || exit 1
+sysctl -q -w net.sctp.sctp_rmem="4096 $BUF $BUF" || exit 1
+trap "sysctl -q -w net.sctp.sctp_wmem='$wmem'; sysctl -q -w net.sctp.sctp_rmem='$rmem'" EXIT
+
+printf "%-10s %-10s %-12s %-14s %s\n" size Gbps msgs/s peak_rss_MiB pool_peak_MiB
+for size in $SIZES; do
+	./build/server -i 0 $SERVER_OPTS > /tmp/sctp_bench_server.log 2>&1 &
+	server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW \
+		-l $size > /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	printf "%-10s %-10s %-12s %-14s %s\n" $size \
+		$(grep -o 'RX rate: [0-9.]*' /tmp/sctp_bench_client.log | tail -1 | grep -o '[0-9.]*$') \
+		$(grep -o 'Messages per second: [0-9.]*' /tmp/sctp_bench_client.log | tail -1 | grep -o '[0-9.]*$') \
+		$(grep -o 'Peak RSS: [0-9.]*' /tmp/sctp_bench_server.log | grep -o '[0-9.]*$') \
+		$(grep -o '[0-9.]*MiB in use' /tmp/sctp_bench_server.log | grep -o '^[0-9.]*')
+done
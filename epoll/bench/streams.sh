@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Shows head-of-line blocking on a lossy link. netem drops packets on the
+# loopback, then the client runs with every association's messages on a
+# single stream and then spread over several, with the same window. With
+# one stream a lost packet holds back every message behind it, with
+# several only the ones on its stream wait. Needs root for tc.
+#
+# usage: bench/streams.sh [loss %] [streams] [window] [clients] [seconds]
+# Run from the epoll directory after make, client and server on this host.
+
+LOSS=${1:-1}
+STREAMS=${2:-8}
+WINDOW=${3:-16}
+CLIENTS=${4:-10}
+DURATION=${5:-10}
+ADDR=127.0.0.1
+DEV=lo
+
+tc qdisc add dev $DEV root netem loss ${LOSS}% || exit 1
+trap "tc qdisc del dev $DEV root" EXIT
+
+run() {
+	local streams=$1
+
+	./build/server -i 0 -s $streams > /dev/null 2>&1 &
+	local server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW \
+		-s $streams > /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	printf "%-8s %s\n" $streams \
+		"$(grep -o 'All streams: .*' /tmp/sctp_bench_client.log | cut -d' ' -f3-)"
+}
+
+echo "${LOSS}% loss, window of $WINDOW per association"
+printf "%-8s %s\n" streams "round trip time (us)"
+run 1
+run $STREAMS
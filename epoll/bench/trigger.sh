@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+# Compares the level-triggered and the edge-triggered reactor by running the
+# same client load against both and printing the wakeups per message and
+# syscalls per KiB reported by the server on exit.
+#
+# usage: bench/trigger.sh [clients] [seconds] [read budget]
+# Run from the epoll directory after make, client and server on this host.
+
+CLIENTS=${1:-5}
+DURATION=${2:-10}
+BUDGET=${3:-16}
+ADDR=127.0.0.1
+
+run() {
+	local mode=$1; shift
+
+	./build/server -i 0 "$@" 2> /tmp/sctp_bench_server.log &
+	local server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -a $ADDR -n $CLIENTS > /dev/null 2>&1
+	kill -INT $server
+	wait $server
+
+	printf "%-6s %s\n" "$mode" \
+		"$(grep -o 'Wakeups per message.*' /tmp/sctp_bench_server.log)"
+}
+
+run LT
+run ET -e -b $BUDGET
@@ -0,0 +1,69 @@
+#!/bin/bash
+#
+# Runs the echo benchmark once for every combination of the tuning
+# settings below, applied to both ends, and prints the best combination
+# for throughput and for the p99 round trip time. Every combination is a
+# profile of a config file written to /tmp/sctp_tune_sweep.conf. Override
+# the grid through the environment, "-" leaves a setting alone, e.g.
+#   BUFS="- 1048576" NODELAYS="1" bench/tune.sh 1024
+#
+# usage: bench/tune.sh [message size] [window] [clients] [seconds]
+# Run from the epoll directory after make, client and server on this host.
+
+SIZE=${1:-1024}
+WINDOW=${2:-8}
+CLIENTS=${3:-10}
+DURATION=${4:-5}
+ADDR=127.0.0.1
+CONF=/tmp/sctp_tune_sweep.conf
+
+BUFS=${BUFS:-"- 262144 4194304"}
+NODELAYS=${NODELAYS:-"0 1"}
+SACK_FREQS=${SACK_FREQS:-"1 2"}
+MAXSEGS=${MAXSEGS:-"- 1200"}
+
+setting() {
+	[ "$2" != "-" ] && echo "$1 = $2"
+}
+
+n=0
+> $CONF
+for buf in $BUFS; do
+	for nodelay in $NODELAYS; do
+		for freq in $SACK_FREQS; do
+			for seg in $MAXSEGS; do
+				n=$((n + 1))
+				{
+					echo "[sweep-$n]"
+					setting sndbuf $buf
+					setting rcvbuf $buf
+					setting nodelay $nodelay
+					setting sack_freq $freq
+					setting maxseg $seg
+				} >> $CONF
+			done
+		done
+	done
+done
+
+results=/tmp/sctp_tune_sweep.results
+> $results
+printf "%-10s %-14s %-12s %s\n" profile msgs/s p99_us settings
+for i in $(seq 1 $n); do
+	./build/server -i 0 -F $CONF -K sweep-$i > /dev/null 2>&1 &
+	server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $WINDOW -l $SIZE \
+		-F $CONF -K sweep-$i > /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	rate=$(grep -o 'Messages per second: [0-9.]*' /tmp/sctp_bench_client.log | tail -1 | grep -o '[0-9.]*$')
+	p99=$(grep 'All streams: ' /tmp/sctp_bench_client.log | grep -o 'p99: [0-9.]*' | grep -o '[0-9.]*$')
+	settings=$(grep -o 'Tuning profile: .*' /tmp/sctp_bench_client.log | cut -d' ' -f4-)
+	printf "%-10s %-14s %-12s %s\n" sweep-$i ${rate:-0} ${p99:-0} "$settings" | tee -a $results
+done
+
+echo
+echo "Best throughput: $(sort -k2 -g -r $results | head -1)"
+echo "Best p99:        $(awk '$3 > 0' $results | sort -k3 -g | head -1)"
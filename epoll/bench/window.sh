@@ -0,0 +1,33 @@
+#!/bin/bash
+#
+# Sweeps the client's in-flight window and prints the throughput at every
+# depth and the round trip time, to find where adding more messages in
+# flight stops paying off and only adds queueing delay.
+#
+# usage: bench/window.sh [clients] [seconds] [depths...]
+# Run from the epoll directory after make, client and server on this host.
+
+CLIENTS=${1:-5}
+DURATION=${2:-10}
+# Plain shift does nothing when fewer arguments are left.
+shift $(( $# < 2 ? $# : 2 ))
+DEPTHS=${@:-1 2 4 8 16 32 64 128}
+ADDR=127.0.0.1
+
+printf "%-6s %-12s %-12s %-14s %-10s %s\n" depth rx_gbps tx_gbps msgs_per_sec p50_us p99_us
+for depth in $DEPTHS; do
+	./build/server > /dev/null 2>&1 &
+	server=$!
+	sleep 1
+	timeout -s INT $DURATION ./build/client -i 0 -a $ADDR -n $CLIENTS -w $depth \
+		> /tmp/sctp_bench_client.log 2>&1
+	kill -INT $server
+	wait $server
+
+	rates=$(grep -o 'RX rate: [0-9.]*Gbps | TX rate: [0-9.]*' /tmp/sctp_bench_client.log |
+		sed 's/[^0-9.]\+/ /g')
+	msgs=$(grep -o 'Messages per second: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	p50=$(grep -o 'p50: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	p99=$(grep -o 'p99: [0-9.]*' /tmp/sctp_bench_client.log | grep -o '[0-9.]*$')
+	printf "%-6s %-12s %-12s %-14s %-10s %s\n" $depth $rates $msgs $p50 $p99
+done
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "common.h"
+#include "bufpool.h"
+#include "affinity.h"
+
+int bufpool_hugepages = FALSE;
+int bufpool_local = FALSE;
+
+static int size_class(size_t size) {
+	int shift = BUFPOOL_MIN_SHIFT;
+
+	while ((1UL << shift) < size) shift++;
+	return shift - BUFPOOL_MIN_SHIFT;
+}
+
+static inline int slabbed(int c) {
+	return c <= BUFPOOL_SLABBED_SHIFT - BUFPOOL_MIN_SHIFT;
+}
+
+static void *map_slab(bufpool_t *p) {
+	void *slab = MAP_FAILED;
+
+	if (bufpool_hugepages) {
+		slab = mmap(NULL, BUFPOOL_SLAB, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (slab != MAP_FAILED) p->huge_slabs++;
+	}
+	if (slab == MAP_FAILED) {
+		slab = mmap(NULL, BUFPOOL_SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (slab == MAP_FAILED) return NULL;
+		// No huge pages reserved, let khugepaged back it if it can
+		if (bufpool_hugepages) madvise(slab, BUFPOOL_SLAB, MADV_HUGEPAGE);
+	}
+	if (bufpool_local) bind_local(slab, BUFPOOL_SLAB);
+	return slab;
+}
+
+// Carves a buffer of the class out of its slab, mapping a new slab once
+// the current one is used up
+static uint8_t *carve(bufpool_t *p, int c, size_t cap) {
+	void **grown;
+	uint8_t *buf;
+
+	if (p->carve_left[c] < cap) {
+		if (p->nb_maps == p->maps_cap) {
+			grown = realloc(p->maps, (p->maps_cap ? 2 * p->maps_cap : 16) * sizeof(void *));
+			if (grown == NULL) return NULL;
+			p->maps = grown;
+			p->maps_cap = p->maps_cap ? 2 * p->maps_cap : 16;
+		}
+		p->carve[c] = map_slab(p);
+		if (p->carve[c] == NULL) {
+			TRACE_ERROR("Unable to map a slab of %ld bytes\n", BUFPOOL_SLAB);
+			p->carve_left[c] = 0;
+			return NULL;
+		}
+		p->maps[p->nb_maps++] = p->carve[c];
+		p->slabs++;
+		p->carve_left[c] = BUFPOOL_SLAB;
+	}
+
+	buf = p->carve[c];
+	p->carve[c] += cap;
+	p->carve_left[c] -= cap;
+	return buf;
+}
+
+uint8_t *bufpool_get(bufpool_t *p, size_t size, size_t *cap) {
+	int c;
+	uint8_t *buf;
+
+	if (size > BUFPOOL_MAX) return NULL;
+	c = size_class(size);
+	*cap = BUFPOOL_MIN << c;
+
+	buf = p->free[c];
+	if (buf) {
+		memcpy(&p->free[c], buf, sizeof(void *));
+		if (!slabbed(c)) p->cached -= *cap;
+		p->hits++;
+	} else {
+		buf = slabbed(c) ? carve(p, c, *cap) : malloc(*cap);
+		if (buf == NULL) return NULL;
+		p->misses++;
+	}
+
+	p->in_use += *cap;
+	if (p->in_use > p->peak) p->peak = p->in_use;
+	return buf;
+}
+
+void bufpool_put(bufpool_t *p, uint8_t *buf, size_t cap) {
+	int c = size_class(cap);
+
+	p->in_use -= cap;
+	if (!slabbed(c)) {
+		if (p->cached + cap > BUFPOOL_MAX_CACHED) {
+			free(buf);
+			return;
+		}
+		p->cached += cap;
+	}
+	memcpy(buf, &p->free[c], sizeof(void *));
+	p->free[c] = buf;
+}
+
+uint8_t *bufpool_grow(bufpool_t *p, uint8_t *buf, size_t *cap, size_t len, size_t size) {
+	size_t grown_cap;
+	uint8_t *grown = bufpool_get(p, size, &grown_cap);
+
+	if (grown == NULL) return NULL;
+	memcpy(grown, buf, len);
+	bufpool_put(p, buf, *cap);
+	*cap = grown_cap;
+	return grown;
+}
+
+void bufpool_sum(bufpool_t *sum, const bufpool_t *p) {
+	sum->hits += p->hits;
+	sum->misses += p->misses;
+	sum->slabs += p->slabs;
+	sum->huge_slabs += p->huge_slabs;
+	sum->peak += p->peak;
+}
+
+void bufpool_print(const char *name, const bufpool_t *p) {
+	TRACE_INFO("%s: %ld hits | %ld misses (%0.4f%%) | %ld slabs, %ld on huge pages | "
+				"at most %0.2fMiB in use\n", name, p->hits, p->misses,
+				p->misses ? 100.0 * p->misses / (p->hits + p->misses) : 0,
+				p->slabs, p->huge_slabs,
+				(double)p->peak / (1024 * 1024));
+}
+
+void bufpool_destroy(bufpool_t *p) {
+	void *buf;
+
+	for (int c = 0; c < BUFPOOL_CLASSES; c++) {
+		if (slabbed(c)) {
+			p->free[c] = NULL;
+			continue;
+		}
+		while ((buf = p->free[c]) != NULL) {
+			memcpy(&p->free[c], buf, sizeof(void *));
+			free(buf);
+		}
+	}
+	for (size_t i = 0; i < p->nb_maps; i++) munmap(p->maps[i], BUFPOOL_SLAB);
+	free(p->maps);
+	p->maps = NULL;
+	p->nb_maps = p->maps_cap = 0;
+	memset(p->carve_left, 0, sizeof(p->carve_left));
+	p->cached = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef BUFPOOL_H_
+#define BUFPOOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Buffers come in power of two sizes from BUFPOOL_MIN to BUFPOOL_MAX
+#define BUFPOOL_MIN_SHIFT (6)
+#define BUFPOOL_MAX_SHIFT (24)
+#define BUFPOOL_MIN (1UL << BUFPOOL_MIN_SHIFT)
+#define BUFPOOL_MAX (1UL << BUFPOOL_MAX_SHIFT)
+#define BUFPOOL_CLASSES (BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+// Buffers up to this size are carved out of slabs of BUFPOOL_SLAB bytes,
+// one huge page, and never go back to the system. The larger ones are
+// allocated one by one.
+#define BUFPOOL_SLABBED_SHIFT (16)
+#define BUFPOOL_SLAB (2UL * 1024 * 1024)
+// Bytes of free large buffers kept for reuse, past that they are freed
+#define BUFPOOL_MAX_CACHED (64UL * 1024 * 1024)
+
+// Back the slabs with huge pages, explicit ones if the system has some
+// reserved and transparent ones otherwise. Set before any pool is used.
+extern int bufpool_hugepages;
+// Take the slabs from the NUMA node of the thread that maps them, rather
+// than from wherever it first touches them
+extern int bufpool_local;
+
+// Free lists of buffers for one thread, shared by all its connections and
+// not locked
+typedef struct bufpool {
+	// Chained through their first bytes
+	void *free[BUFPOOL_CLASSES];
+	// What is left of the slab every class is carved from
+	uint8_t *carve[BUFPOOL_CLASSES];
+	size_t carve_left[BUFPOOL_CLASSES];
+	// Every slab, to give them back in the end
+	void **maps;
+	size_t nb_maps, maps_cap;
+	// Bytes of free large buffers
+	size_t cached;
+
+	// Buffers that came off a free list and those that needed fresh memory,
+	// and slabs mapped so far, on huge pages or not. Kept when destroyed.
+	size_t hits;
+	size_t misses;
+	size_t slabs;
+	size_t huge_slabs;
+	// Bytes handed out and not given back yet, and the most there were
+	size_t in_use;
+	size_t peak;
+} bufpool_t;
+
+// Returns a buffer of at least size bytes, its actual size in cap, NULL if
+// size is above BUFPOOL_MAX or nothing could be allocated
+uint8_t *bufpool_get(bufpool_t *p, size_t size, size_t *cap);
+
+void bufpool_put(bufpool_t *p, uint8_t *buf, size_t cap);
+
+// Moves the first len bytes of buf into a buffer of at least size bytes
+// and gives buf back. Returns NULL and leaves buf alone if that fails.
+uint8_t *bufpool_grow(bufpool_t *p, uint8_t *buf, size_t *cap, size_t len, size_t size);
+
+// Gives all memory back, the buffers in use have to be given back first
+void bufpool_destroy(bufpool_t *p);
+
+// Adds the stats of p to those of sum, the peaks add up too
+void bufpool_sum(bufpool_t *sum, const bufpool_t *p);
+
+void bufpool_print(const char *name, const bufpool_t *p);
+
+#endif /* BUFPOOL_H_ */
@@ -1,3 +1,6 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -10,32 +13,259 @@
 #include <pthread.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 
 #include "debug.h"
 #include "common.h"
+#include "uring.h"
+#include "hist.h"
+#include "report.h"
+#include "policy.h"
+#include "batch.h"
+#include "tune.h"
+#include "trace.h"
+#include "affinity.h"
 
 #define DEAFULT_CLIENTS (5)
 #define MAX_CPUS (100)
+#define MAX_CLIENTS (65536)
 
 #define DST_ADDR "192.168.0.10"
 #define PORT (8877)
 
 #define MAX_BUFF (1024)
+// Bulk messages larger than MAX_BUFF are read in pieces of up to RX_CHUNK
+#define MAX_MSG (16 * 1024 * 1024)
+#define RX_CHUNK (64 * 1024)
 
+// Streams the messages of an association are spread over
+#define DEFAULT_STREAMS (1)
+#define MAX_STREAMS (64)
+#define SINFO_CTRL_SIZE (CMSG_SPACE(sizeof(struct sctp_sndrcvinfo)))
+
+// In a traffic mix, the size of the control messages on stream 0. The
+// bulk messages on the other streams are msg_size.
+#define CONTROL_SIZE (64)
+
+#define DEFAULT_WINDOW (1)
+#define MAX_WINDOW (1024)
+
+// With PR-SCTP a message or its echo may never arrive. The default time
+// after which it counts as lost is twice the time to live plus this slack
+// with a ttl policy, DEFAULT_LOSS_TIMEOUT otherwise, in milliseconds.
+#define LOSS_SLACK (100)
+#define DEFAULT_LOSS_TIMEOUT (1000)
+// Overdue messages are looked for this many times per loss timeout
+#define LOSS_SWEEPS (4)
+
+#define BURST_SIZE (32)
+// Initial number of arrivals that can wait for a free association, grows
+// as needed
+#define BACKLOG_SIZE (1024)
+#define URING_ENTRIES (4096)
+// Storm mode: how long a worker waits before it retries the associations
+// it could not even start a handshake for
+#define STORM_RETRY_MS (10)
+
+// The operation is kept in the low bits of the io_uring user data, the rest
+// is the connection it belongs to
+#define OP_WAKE (0)
+#define OP_SEND (1)
+#define OP_RECV (2)
+#define OP_MASK (3)
+
+typedef enum {
+	ARRIVAL_CONSTANT,
+	ARRIVAL_POISSON,
+} arrival_t;
+
+// Only written by the worker it belongs to, and kept on cache lines of its
+// own so the workers don't false-share them
 typedef struct client_stats {
-	size_t rx;
-	size_t tx;
+	// Bytes, and echoes that came back in full, sampled by the reporter
+	counters_t io;
 
 	double rx_rate;
 	double tx_rate;
-} client_stats_t;
+	double msg_rate;
+
+	// Messages whose echo didn't come back within the loss timeout, and
+	// echoes that still did after that
+	size_t lost;
+	size_t late;
+	// What PR-SCTP gave up on, of the messages we sent
+	abandoned_t abandoned;
+	// SCTP messages written with batching, the messages are in io.msgs
+	size_t batches;
+	// Storm mode: handshakes that failed, the ones that completed are in
+	// io.msgs
+	size_t failed;
+} __attribute__((aligned(CACHE_LINE))) client_stats_t;
+
+#ifdef LATENCY
+// Stamped at the front of every message, the server echoes it back as is
+typedef struct msg_hdr {
+	nano_ts_t send_ts;
+	// Messages the association wrote before this one
+	uint64_t seq;
+	uint16_t stream;
+} msg_hdr_t;
+#endif
+
+// Echo being read on a stream, with interleaving the pieces of echoes on
+// different streams come in mixed
+typedef struct rx_state {
+	size_t recvd;
+	// With batching, where we are in the batch the echo came in
+	unbatch_t unbatch;
+#ifdef LATENCY
+	// A read may stop in the middle of the header
+	msg_hdr_t hdr;
+#endif
+} rx_state_t;
+
+struct worker;
+
+// One association driven by a worker
+typedef struct cconn {
+	int sockid;
+	struct worker *worker;
+
+	// Bytes of the message being written so far, and the echo being read
+	// on every stream
+	size_t sent;
+	rx_state_t *rx;
+	// Messages written in full since the oldest one whose echo did not
+	// fully come back yet, the window
+	int inflight;
+	// When they were written, oldest first from sent_head, only kept to
+	// detect lost messages. The oldest is message head_seq. With LATENCY
+	// an echo is matched to its message by the sequence number in its
+	// header and the slot is cleared, since echoes may come back in any
+	// order; the window only moves on once the oldest one is back or lost.
+	// Without it every echo is taken for the one of the oldest message.
+	nano_ts_t *sent_ts;
+	int sent_head;
+	size_t head_seq;
+	// Streams the peer accepted and the one the message being written
+	// goes out on, the next message takes the next one
+	uint16_t nb_streams;
+	uint16_t stream;
+	// Messages written in full so far and the last bulk stream of a
+	// traffic mix
+	size_t written;
+	uint16_t bulk_stream;
+	// Events currently registered with the worker's epoll
+	int events;
+	// A send is in flight on the ring
+	int send_armed;
+	// Open loop: waiting on the worker's idle list for an arrival
+	int idle;
+	struct cconn *idle_next;
+	// Messages waiting to be written as one, sent counts its bytes then
+	batch_t batch;
+	// Where the ring receives this association's echoes
+	uint8_t *rx_buf;
+	// The sendmsg in flight on the ring, the stream goes in the control data
+	struct msghdr smsg;
+	struct iovec siov;
+	union {
+		char buf[SINFO_CTRL_SIZE];
+		struct cmsghdr align;
+	} sctrl;
+#ifdef LATENCY
+	// The message being written, with its own header
+	uint8_t *msg;
+#endif
+	// Storm mode: when the handshake in flight started
+	nano_ts_t connect_ts;
+} cconn_t;
+
+// A thread that drives many associations
+typedef struct worker {
+	int id;
+	pthread_t thread;
+	int epoll_fd;
+	// Written by the main thread to get the worker out of epoll_wait
+	int wake_fd;
+
+	cconn_t *conns;
+	int nb_conns;
+
+	// The message every association sends, shared and never modified
+	uint8_t *data;
+	size_t datalen;
+	// Every message buffer of the worker comes from here, the ones of
+	// the size of data are data_cap bytes
+	bufpool_t pool;
+	size_t data_cap;
+
+	// Open loop: when the next message is due, at this worker's share of
+	// the target rate
+	double next_arrival;
+	double rate;
+	unsigned short seed[3];
+	// Arrivals that found no association with room in its window, with
+	// the time they were due at
+	nano_ts_t *backlog;
+	size_t backlog_head, backlog_tail, backlog_size;
+	size_t backlog_peak;
+	// Associations with room in their window, served round robin
+	cconn_t *idle_head, *idle_tail;
+	// When the associations are next checked for overdue messages
+	nano_ts_t next_sweep;
+	// When the oldest batch not written yet is due, 0 if there is none
+	nano_ts_t next_flush;
+
+	client_stats_t stats;
+	// Storm mode: how long every handshake took, in nanoseconds, and when
+	// the storm started and ended
+	hist_t *handshake;
+	nano_ts_t storm_start_ts, storm_end_ts;
+#ifdef LATENCY
+	// Round trip time of every message, in nanoseconds, one per stream
+	hist_t *rtt;
+#endif
+#ifdef RATE
+	nano_ts_t rx_start_ts, rx_end_ts;
+	nano_ts_t tx_start_ts, tx_end_ts;
+	// Taken once per wakeup for the rates
+	nano_ts_t now;
+#endif
+} worker_t;
 
 int force_quit = 0;
+char *dst_addr = DST_ADDR;
+int use_uring = FALSE;
+int window = DEFAULT_WINDOW;
+int nb_streams = DEFAULT_STREAMS;
+// Target messages per second over all associations, 0 is closed loop
+double target_rate = 0;
+arrival_t arrival = ARRIVAL_CONSTANT;
+// Every control_every-th message is a control message, 0 is no traffic mix
+int control_every = 0;
+// Size of the bulk messages
+size_t msg_size = MAX_BUFF;
+int interleave = FALSE;
+// Messages are packed into SCTP messages of up to batch_size bytes, written
+// once full or batch_delay after the first message went in. 0 is off.
+size_t batch_size = 0;
+nano_ts_t batch_delay = 0;
+int nodelay = FALSE;
+// CPUs the workers are pinned to, in turn, empty leaves them to the
+// scheduler
+cpu_list_t worker_cpus;
+// Time after which a message without echo is lost, 0 if they never are
+nano_ts_t loss_timeout = 0;
+int report_interval = DEFAULT_REPORT_INTERVAL;
+// Open and close associations in a loop instead of sending messages
+int storm = FALSE;
 
-uint8_t* generate_msg(size_t len) {
+uint8_t* generate_msg(bufpool_t *pool, size_t len, size_t *cap) {
 	uint8_t byte = 0;
-	uint8_t *msg = malloc(sizeof(uint8_t) * len);
+	uint8_t *msg = bufpool_get(pool, len, cap);
 
+	if (msg == NULL) return NULL;
 	for (int i = 0; i < len; i++) {
 		msg[i] = byte;
 		byte = (byte + 1) % 256;
@@ -43,27 +273,72 @@ uint8_t* generate_msg(size_t len) {
 	return msg;
 }
 
-int create_connection() {
-	int sockid, ret, flags;
-	struct sockaddr_in servaddr;
+void server_addr(struct sockaddr_in *servaddr) {
+	bzero((void *)servaddr, sizeof(*servaddr));
+	servaddr->sin_family = AF_INET;
+	servaddr->sin_port = htons(PORT);
+	servaddr->sin_addr.s_addr = inet_addr(dst_addr);
+}
+
+// Creates a socket with every option the associations ask for, flags go
+// to socket along with the type. Returns -1 on failure.
+int open_socket(int flags) {
+	int sockid, ret;
+	struct sctp_initmsg initmsg;
+	struct sctp_event_subscribe events;
 
-	sockid = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+	sockid = socket(AF_INET, SOCK_STREAM | flags, IPPROTO_SCTP);
 	if (sockid == -1) {
-		TRACE_ERROR("Failed to create server socket\n");
-		goto socket_failed;
+		TRACE_ERROR("Failed to create server socket, error: %s\n", strerror(errno));
+		return -1;
 	}
 
-	bzero((void *)&servaddr, sizeof(servaddr));
-	servaddr.sin_family = AF_INET;
-	servaddr.sin_port = htons(PORT);
-	servaddr.sin_addr.s_addr = inet_addr(DST_ADDR);
+	if (tune_apply(sockid, &tuning) == FALSE) goto failed_exit;
+
+	memset(&initmsg, 0, sizeof(initmsg));
+	initmsg.sinit_num_ostreams = nb_streams;
+	initmsg.sinit_max_instreams = nb_streams;
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_INITMSG, &initmsg, sizeof(initmsg));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to ask for %d streams, error: %s\n", nb_streams, strerror(errno));
+		goto failed_exit;
+	}
+
+	// The stream of every echo, with interleaving they can't be told
+	// apart otherwise
+	memset(&events, 0, sizeof(events));
+	events.sctp_data_io_event = 1;
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_EVENTS, &events, sizeof(events));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to subscribe to SCTP events, error: %s\n", strerror(errno));
+		goto failed_exit;
+	}
+
+	if (policy_partial(&send_policy) && enable_partial(sockid) == FALSE) goto failed_exit;
+	if (interleave && enable_interleaving(sockid, MAX_BUFF) == FALSE) goto failed_exit;
+	if (nodelay && set_nodelay(sockid) == FALSE) goto failed_exit;
+	return sockid;
+
+failed_exit:
+	close(sockid);
+	return -1;
+}
+
+int create_connection() {
+	int sockid, ret, flags;
+	struct sockaddr_in servaddr;
+
+	sockid = open_socket(0);
+	if (sockid == -1) return FALSE;
 
+	server_addr(&servaddr);
 	ret = connect(sockid, (struct sockaddr *)&servaddr, sizeof(servaddr));
 	if (ret == -1) {
 		TRACE_ERROR("Unable to connect to the server, error: %s\n", strerror(errno));
 		goto failed_exit;
 	}
 	TRACE_INFO("Connected with the server, sockid: %d\n", sockid);
+	if (set_sched(sockid, 0, &stream_sched) == FALSE) goto failed_exit;
 
 	flags = fcntl(sockid, F_GETFL, 0);
 	ret = fcntl(sockid, F_SETFL, flags | O_NONBLOCK);
@@ -76,105 +351,1065 @@ int create_connection() {
 
 failed_exit:
 	close(sockid);
-socket_failed:
 	return FALSE;
 }
 
-void handle_connection(int sockid, client_stats_t *stats) {
-	int r, w, ret;
-	uint8_t buffer[MAX_BUFF];
-	uint8_t *data = generate_msg(MAX_BUFF);
-	size_t datalen = MAX_BUFF;
-	size_t bytes_to_send;
+// Returns how many streams we can send on, the server may have offered
+// fewer inbound streams than we asked for
+int negotiated_streams(int sockid) {
+	int ret;
+	struct sctp_status status;
+	socklen_t len = sizeof(status);
+
+	memset(&status, 0, sizeof(status));
+	ret = getsockopt(sockid, IPPROTO_SCTP, SCTP_STATUS, &status, &len);
+	if (ret == -1) {
+		TRACE_ERROR("Unable to get the association status, error: %s\n", strerror(errno));
+		return nb_streams;
+	}
+	if (status.sstat_outstrms > 0 && status.sstat_outstrms < nb_streams) {
+		TRACE_INFO("The server only accepted %d streams on %d\n", status.sstat_outstrms, sockid);
+		return status.sstat_outstrms;
+	}
+	return nb_streams;
+}
+
+int set_events(cconn_t *conn, int events) {
+	int ret;
+	struct epoll_event ev;
+
+	if (events == conn->events) return TRUE;
+
+	ev.events = events;
+	ev.data.ptr = conn;
+	ret = epoll_ctl(conn->worker->epoll_fd, conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+					conn->sockid, &ev);
+	if (ret == -1) {
+		TRACE_ERROR("Unable to register connection with epoll, epoll_ctl: %s\n", strerror(errno));
+		return FALSE;
+	}
+	conn->events = events;
+	return TRUE;
+}
+
+static inline uint8_t *msg_data(cconn_t *conn) {
+#ifdef LATENCY
+	return conn->msg;
+#else
+	return conn->worker->data;
+#endif
+}
+
+static inline int mixed(cconn_t *conn) {
+	return control_every && conn->nb_streams > 1;
+}
+
+// Size of the message being written, control messages are the small ones
+static inline size_t msg_len(cconn_t *conn) {
+	if (mixed(conn) && conn->stream == 0) return CONTROL_SIZE;
+	return conn->worker->datalen;
+}
+
+static inline void stamp_msg(cconn_t *conn, nano_ts_t ts) {
+#ifdef LATENCY
+	msg_hdr_t hdr;
+
+	hdr.send_ts = ts;
+	hdr.seq = conn->written;
+	hdr.stream = conn->stream;
+	memcpy(conn->msg, &hdr, sizeof(hdr));
+#endif
+}
+
+static inline int backlog_empty(worker_t *w) {
+	return w->backlog_head == w->backlog_tail;
+}
+
+int backlog_push(worker_t *w, nano_ts_t due) {
+	size_t len = w->backlog_tail - w->backlog_head;
+	nano_ts_t *grown;
+
+	if (len == w->backlog_size) {
+		grown = malloc(2 * w->backlog_size * sizeof(nano_ts_t));
+		if (grown == NULL) return FALSE;
+		for (size_t i = 0; i < len; i++)
+			grown[i] = w->backlog[(w->backlog_head + i) % w->backlog_size];
+		free(w->backlog);
+		w->backlog = grown;
+		w->backlog_size *= 2;
+		w->backlog_head = 0;
+		w->backlog_tail = len;
+	}
+	w->backlog[w->backlog_tail++ % w->backlog_size] = due;
+	if (len + 1 > w->backlog_peak) w->backlog_peak = len + 1;
+	return TRUE;
+}
+
+static inline nano_ts_t backlog_pop(worker_t *w) {
+	return w->backlog[w->backlog_head++ % w->backlog_size];
+}
+
+void push_idle(cconn_t *conn) {
+	worker_t *w = conn->worker;
+
+	if (conn->idle) return;
+	conn->idle = TRUE;
+	conn->idle_next = NULL;
+	if (w->idle_tail) w->idle_tail->idle_next = conn;
+	else w->idle_head = conn;
+	w->idle_tail = conn;
+}
+
+cconn_t *pop_idle(worker_t *w) {
+	cconn_t *conn = w->idle_head;
+
+	if (conn == NULL) return NULL;
+	w->idle_head = conn->idle_next;
+	if (w->idle_head == NULL) w->idle_tail = NULL;
+	conn->idle = FALSE;
+	return conn;
+}
+
+// Time until the next arrival of this worker's share of the load
+double interarrival(worker_t *w) {
+	double gap = SEC_TO_NANO(1) / w->rate;
+
+	if (arrival == ARRIVAL_POISSON) return -log(1 - erand48(w->seed)) * gap;
+	return gap;
+}
+
+// Starts the next message on the association if there is one. Closed loop
+// that is always the case, open loop only if an arrival is waiting for it.
+int next_msg(cconn_t *conn) {
+	worker_t *w = conn->worker;
+
+	if (target_rate == 0) {
+#ifdef LATENCY
+		stamp_msg(conn, nano_ts());
+#endif
+		return TRUE;
+	}
+
+	if (backlog_empty(w)) {
+		push_idle(conn);
+		return FALSE;
+	}
+	// The message counts as sent when it was due, so the time it waited
+	// for an association shows up in its latency
+	stamp_msg(conn, backlog_pop(w));
+	return TRUE;
+}
+
+// The message went out in full, the next one takes the next stream. In a
+// traffic mix every control_every-th message is a control message on
+// stream 0 and the bulk messages go round robin over the others.
+static inline void msg_written(cconn_t *conn) {
+	if (conn->sent_ts) conn->sent_ts[(conn->sent_head + conn->inflight) % window] = nano_ts();
+	conn->sent = 0;
+	conn->inflight++;
+	conn->written++;
+	if (!mixed(conn)) {
+		conn->stream = (conn->stream + 1) % conn->nb_streams;
+	} else if (conn->written % control_every == 0) {
+		conn->stream = 0;
+	} else {
+		conn->bulk_stream = conn->bulk_stream % (conn->nb_streams - 1) + 1;
+		conn->stream = conn->bulk_stream;
+	}
+}
+
+// Drops the oldest message from the window
+static inline void pop_sent(cconn_t *conn) {
+	conn->sent_head = (conn->sent_head + 1) % window;
+	conn->head_seq++;
+	conn->inflight--;
+}
+
+#ifdef LATENCY
+// Clears the slot of message seq, returns FALSE if it is not in flight
+// anymore because it was given up on
+static int ack_sent(cconn_t *conn, uint64_t seq) {
+	uint64_t off = seq - conn->head_seq;
+	int slot;
+
+	// Older than the window wraps around to a large offset
+	if (off >= conn->inflight) return FALSE;
+	slot = (conn->sent_head + off) % window;
+	if (conn->sent_ts[slot] == 0) return FALSE;
+	conn->sent_ts[slot] = 0;
+	while (conn->inflight > 0 && conn->sent_ts[conn->sent_head] == 0) pop_sent(conn);
+	return TRUE;
+}
+#endif
+
+// Takes the message of the echo out of the window, returns FALSE if it
+// was given up on already
+static int ack_echo(cconn_t *conn, rx_state_t *rx) {
+#ifdef LATENCY
+	if (conn->sent_ts) return ack_sent(conn, rx->hdr.seq);
+#endif
+	if (conn->inflight == 0) return FALSE;
+	if (conn->sent_ts) pop_sent(conn);
+	else conn->inflight--;
+	return TRUE;
+}
+
+// Accounts len bytes of echo on the stream, eor is set if they are the
+// end of it
+void recv_echo(cconn_t *conn, uint16_t stream, uint8_t *buf, size_t len, int eor) {
+	worker_t *w = conn->worker;
+	rx_state_t *rx = &conn->rx[stream < conn->nb_streams ? stream : 0];
+#ifdef LATENCY
+	size_t n;
+
+	if (rx->recvd < sizeof(msg_hdr_t)) {
+		n = MIN(len, sizeof(msg_hdr_t) - rx->recvd);
+		memcpy((uint8_t *)&rx->hdr + rx->recvd, buf, n);
+	}
+#endif
+	rx->recvd += len;
+	if (!eor) return;
+
+	rx->recvd = 0;
+	// Its message was already given up on
+	if (ack_echo(conn, rx) == FALSE) w->stats.late++;
+	count(&w->stats.io.msgs, 1);
+#ifdef LATENCY
+	if (rx->hdr.stream < nb_streams)
+		hist_record(&w->rtt[rx->hdr.stream], nano_ts() - rx->hdr.send_ts);
+#endif
+}
+
+// The ring doesn't say where an echo ends or which stream it is on, but
+// without a traffic mix or interleaving they all have the same size and
+// come one after the other
+void recv_fixed(cconn_t *conn, uint8_t *buf, size_t len) {
+	size_t n;
+	worker_t *w = conn->worker;
+
+	while (len > 0) {
+		n = MIN(len, w->datalen - conn->rx[0].recvd);
+		recv_echo(conn, 0, buf, n, conn->rx[0].recvd + n == w->datalen);
+		buf += n;
+		len -= n;
+	}
+}
+
+// Same as send_msg, but packs the messages into the batch of the
+// association, which is written as one SCTP message once the next message
+// doesn't fit or it is batch_delay old. Without a delay it is written as
+// soon as nothing more can go in right away.
+int send_batch(cconn_t *conn) {
+	int ret, started = 0;
+	nano_ts_t due;
+	worker_t *w = conn->worker;
+	batch_t *b = &conn->batch;
+
+	for (;;) {
+		// Nothing goes in while it is partly written
+		while (conn->sent == 0 && conn->inflight < window && batch_fits(b, msg_len(conn))) {
+			if (target_rate && started) {
+				push_idle(conn);
+				break;
+			}
+			if (next_msg(conn) == FALSE) break;
+			started++;
+			batch_add(b, msg_data(conn), msg_len(conn), conn->stream);
+			msg_written(conn);
+		}
+		if (b->len == 0) break;
+
+		if (conn->sent == 0 && batch_delay && batch_fits(b, msg_len(conn))) {
+			due = b->first_ts + batch_delay;
+			if (nano_ts() < due) {
+				if (w->next_flush == 0 || due < w->next_flush) w->next_flush = due;
+				break;
+			}
+		}
+
 #ifdef RATE
-	micro_ts_t rx_start_ts, rx_end_ts;
-	rx_start_ts = rx_end_ts = 0;
+		if (w->stats.io.tx == 0) w->tx_start_ts = w->now;
+#endif
+		ret = SCTP_WRITE_STREAM(conn->sockid, b->buf + conn->sent, b->len - conn->sent,
+								b->stream, &send_policy);
+		if (ret < 0) {
+			if (errno != EAGAIN) {
+				TRACE_ERROR("An error occur red while writing to server\n");
+				return FALSE;
+			}
+			return set_events(conn, EPOLLIN | EPOLLOUT);
+		}
 
-	micro_ts_t tx_start_ts, tx_end_ts;
-	tx_start_ts = tx_end_ts = 0;
+		conn->sent += ret;
+		count(&w->stats.io.tx, ret);
+#ifdef RATE
+		w->tx_end_ts = w->now;
 #endif
+		if (conn->sent < b->len) continue;
+		trace_event(TR_BATCH, conn->sockid, b->len, b->msgs, b->stream);
+		conn->sent = 0;
+		w->stats.batches++;
+		batch_reset(b);
+	}
 
-	while (!force_quit) {
-		w = 0;
-		bytes_to_send = datalen;
-		// Send the complete message
-		while (w < datalen) {
-#ifdef RATE
-			if (stats->tx == 0) tx_start_ts = micro_ts();
-#endif
-			ret = SCTP_WRITE(sockid, data + w, bytes_to_send);
-			if (ret < 0) {
-				if (errno != EAGAIN) {
-					TRACE_ERROR("An error occur red while writing to server\n");
-					goto exit;
-				}
-				if (force_quit) goto exit;
+	trace_event(TR_INFLIGHT, conn->sockid, 0, conn->inflight, 0);
+	return set_events(conn, EPOLLIN);
+}
+
+// Writes messages until the window is full, waits for EPOLLOUT if the
+// socket doesn't take all of them. Open loop it starts at most one message
+// so the arrivals are spread over the associations.
+int send_msg(cconn_t *conn) {
+	int ret, started = 0;
+	worker_t *w = conn->worker;
+
+	if (batch_size) return send_batch(conn);
+	while (conn->inflight < window) {
+#ifdef RATE
+		if (w->stats.io.tx == 0) w->tx_start_ts = w->now;
+#endif
+		if (conn->sent == 0) {
+			if (target_rate && started) {
+				push_idle(conn);
+				break;
+			}
+			if (next_msg(conn) == FALSE) break;
+			started++;
+		}
+		ret = SCTP_WRITE_STREAM(conn->sockid, msg_data(conn) + conn->sent,
+								msg_len(conn) - conn->sent, conn->stream, &send_policy);
+		if (ret < 0) {
+			if (errno != EAGAIN) {
+				TRACE_ERROR("An error occur red while writing to server\n");
+				return FALSE;
+			}
+			return set_events(conn, EPOLLIN | EPOLLOUT);
+		}
+
+		conn->sent += ret;
+		count(&w->stats.io.tx, ret);
+#ifdef RATE
+		w->tx_end_ts = w->now;
+#endif
+		if (conn->sent == msg_len(conn)) msg_written(conn);
+	}
+
+	trace_event(TR_INFLIGHT, conn->sockid, 0, conn->inflight, 0);
+	return set_events(conn, EPOLLIN);
+}
+
+// Splits an echoed batch into the echoes of its messages
+void recv_batch(cconn_t *conn, uint16_t stream, uint8_t *buf, size_t len, int eor) {
+	int end;
+	size_t n;
+	const uint8_t *data = buf, *piece;
+	rx_state_t *rx = &conn->rx[stream < conn->nb_streams ? stream : 0];
+
+	while ((n = unbatch_next(&rx->unbatch, &data, &len, &piece, &end)) > 0)
+		recv_echo(conn, stream, (uint8_t *)piece, n, end);
+
+	if (eor && (rx->unbatch.left || rx->unbatch.hdr_len)) {
+		TRACE_ERROR("A batch echoed on %d ended in the middle of a message\n", conn->sockid);
+		memset(&rx->unbatch, 0, sizeof(unbatch_t));
+	}
+}
+
+// Reads echoes and refills the window for every one that fully came back
+int recv_msg(cconn_t *conn) {
+	int r, flags = 0;
+	uint8_t buffer[RX_CHUNK];
+	struct sctp_sndrcvinfo sinfo;
+	worker_t *w = conn->worker;
+
+#ifdef RATE
+	if (w->stats.io.rx == 0) w->rx_start_ts = w->now;
+#endif
+	r = SCTP_READ_INFO(conn->sockid, buffer,
+					   msg_size > MAX_BUFF || batch_size ? RX_CHUNK : MAX_BUFF, &sinfo, &flags);
+	if (r <= 0) {
+		if (r == 0) {
+			TRACE_ERROR("The connection closed from the server side, exiting\n");
+			return FALSE;
+		} else if (errno != EAGAIN) {
+			TRACE_ERROR("An error occured while reading from server\n");
+			return FALSE;
+		}
+		return TRUE;
+	}
+	count(&w->stats.io.rx, r);
+#ifdef RATE
+	w->rx_end_ts = w->now;
+#endif
+
+	if (batch_size) recv_batch(conn, sinfo.sinfo_stream, buffer, r, flags & MSG_EOR);
+	else recv_echo(conn, sinfo.sinfo_stream, buffer, r, flags & MSG_EOR);
+	if (conn->inflight >= window || conn->sent > 0) return TRUE;
+	return send_msg(conn);
+}
+
+void close_cconn(cconn_t *conn) {
+	if (conn->sockid == -1) return;
+	if (policy_partial(&send_policy))
+		get_abandoned(conn->sockid, 0, &conn->worker->stats.abandoned);
+	if (conn->events) epoll_ctl(conn->worker->epoll_fd, EPOLL_CTL_DEL, conn->sockid, NULL);
+	close(conn->sockid);
+	conn->sockid = -1;
+}
+
+// Queues every arrival that is due by now and hands them to associations
+// with room in their window. Returns how many nanoseconds are left until
+// the next one is due.
+nano_ts_t dispatch_arrivals(worker_t *w) {
+	nano_ts_t now = nano_ts();
+	cconn_t *conn;
+
+	while (w->next_arrival <= now) {
+		if (backlog_push(w, w->next_arrival) == FALSE) {
+			TRACE_ERROR("Unable to grow the backlog, dropping an arrival\n");
+		}
+		w->next_arrival += interarrival(w);
+	}
+
+	while (!backlog_empty(w) && (conn = pop_idle(w)) != NULL) {
+		// Closed since it went idle
+		if (conn->sockid == -1) continue;
+		if (send_msg(conn) == FALSE) close_cconn(conn);
+	}
+
+	return w->next_arrival - now;
+}
+
+// Counts every message whose echo is overdue as lost, so what PR-SCTP
+// gave up on doesn't hold a place in the window forever. Returns how many
+// nanoseconds are left until the next sweep.
+nano_ts_t sweep_lost(worker_t *w) {
+	int expired;
+	cconn_t *conn;
+	nano_ts_t now = nano_ts();
+
+	if (now < w->next_sweep) return w->next_sweep - now;
+	w->next_sweep = now + loss_timeout / LOSS_SWEEPS;
+
+	for (int i = 0; i < w->nb_conns; i++) {
+		conn = &w->conns[i];
+		if (conn->sockid == -1) continue;
+
+		expired = 0;
+		while (conn->inflight > 0) {
+			// Echoed already, it only waited for the older ones
+			if (conn->sent_ts[conn->sent_head] == 0) {
+				pop_sent(conn);
 				continue;
 			}
-			if (force_quit) goto exit;
+			if (now - conn->sent_ts[conn->sent_head] <= loss_timeout) break;
+			pop_sent(conn);
+			expired++;
+		}
+		if (expired == 0) continue;
 
-			w += ret;
-			bytes_to_send -= w;
+		w->stats.lost += expired;
+		trace_event(TR_LOST, conn->sockid, 0, expired, 0);
+		// A message only partly written is still on its way out
+		if (conn->sent == 0 && send_msg(conn) == FALSE) close_cconn(conn);
+	}
+	return w->next_sweep - now;
+}
+
+// Writes every batch that waited batch_delay. Returns how many nanoseconds
+// are left until the next one is due.
+nano_ts_t flush_batches(worker_t *w) {
+	cconn_t *conn;
+	nano_ts_t now = nano_ts();
+
+	if (w->next_flush == 0) return ~(nano_ts_t)0;
+	if (now < w->next_flush) return w->next_flush - now;
+
+	// The ones not due yet put themselves back
+	w->next_flush = 0;
+	for (int i = 0; i < w->nb_conns; i++) {
+		conn = &w->conns[i];
+		if (conn->sockid == -1 || conn->batch.len == 0 || conn->sent) continue;
+		if (send_batch(conn) == FALSE) close_cconn(conn);
+	}
+	if (w->next_flush == 0) return ~(nano_ts_t)0;
+	return w->next_flush > now ? w->next_flush - now : 0;
+}
+
+void run_epoll(worker_t *w) {
+	int nb_ev;
+	nano_ts_t delay, sweep, flush;
+	cconn_t *conn;
+	struct timespec timeout;
+	struct epoll_event ev[BURST_SIZE];
+
+#ifdef RATE
+	w->now = nano_ts();
+#endif
+	if (target_rate) {
+		w->next_arrival = nano_ts();
+		for (int i = 0; i < w->nb_conns; i++) {
+			if (w->conns[i].sockid != -1) push_idle(&w->conns[i]);
+		}
+	} else {
+		for (int i = 0; i < w->nb_conns; i++) {
+			if (w->conns[i].sockid == -1) continue;
+			if (send_msg(&w->conns[i]) == FALSE) close_cconn(&w->conns[i]);
+		}
+	}
+
+	while (!force_quit) {
+		if (target_rate || loss_timeout || batch_delay) {
+			delay = target_rate ? dispatch_arrivals(w) : ~(nano_ts_t)0;
+			if (loss_timeout) {
+				sweep = sweep_lost(w);
+				if (sweep < delay) delay = sweep;
+			}
+			if (batch_delay) {
+				flush = flush_batches(w);
+				if (flush < delay) delay = flush;
+			}
+			// epoll_wait only sleeps in milliseconds, too coarse to keep
+			// the arrivals on schedule
+			timeout.tv_sec = delay / NSEC_PER_SEC;
+			timeout.tv_nsec = delay % NSEC_PER_SEC;
+			nb_ev = epoll_pwait2(w->epoll_fd, ev, BURST_SIZE, &timeout, NULL);
+		} else {
+			nb_ev = epoll_wait(w->epoll_fd, ev, BURST_SIZE, -1);
+		}
 #ifdef RATE
-			stats->tx += ret;
-			tx_end_ts = micro_ts();
+		w->now = nano_ts();
 #endif
+		for (int i = 0; i < nb_ev; i++) {
+			conn = (cconn_t *)ev[i].data.ptr;
+			// Only the wake eventfd is registered without a connection
+			if (conn == NULL) continue;
+
+			if (ev[i].events & EPOLLOUT) {
+				if (send_msg(conn) == FALSE) {
+					close_cconn(conn);
+					continue;
+				}
+			}
+			if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+				if (recv_msg(conn) == FALSE) close_cconn(conn);
+			}
 		}
+	}
+}
+
+struct io_uring_sqe *get_sqe(uring_t *ring) {
+	struct io_uring_sqe *sqe;
+
+	// Make room by handing what we have so far to the kernel
+	while ((sqe = uring_get_sqe(ring)) == NULL) uring_submit_and_wait(ring, 0);
+	return sqe;
+}
+
+void uring_send(uring_t *ring, cconn_t *conn) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	struct cmsghdr *cmsg;
+	struct sctp_sndrcvinfo sinfo;
+
+	if (conn->sent == 0) next_msg(conn);
 
-		TRACE_DEBUG("Sent %d bytes and now trying to read %ld bytes\n", w, datalen);
+	conn->siov.iov_base = msg_data(conn) + conn->sent;
+	conn->siov.iov_len = msg_len(conn) - conn->sent;
+	memset(&conn->smsg, 0, sizeof(conn->smsg));
+	conn->smsg.msg_iov = &conn->siov;
+	conn->smsg.msg_iovlen = 1;
+	conn->smsg.msg_control = conn->sctrl.buf;
+	conn->smsg.msg_controllen = sizeof(conn->sctrl.buf);
 
+	memset(&sinfo, 0, sizeof(sinfo));
+	sinfo.sinfo_stream = conn->stream;
+	policy_sinfo(&send_policy, &sinfo);
+	cmsg = CMSG_FIRSTHDR(&conn->smsg);
+	cmsg->cmsg_level = IPPROTO_SCTP;
+	cmsg->cmsg_type = SCTP_SNDRCV;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(sinfo));
+	memcpy(CMSG_DATA(cmsg), &sinfo, sizeof(sinfo));
+
+	uring_prep_sendmsg(sqe, conn->sockid, &conn->smsg);
+	sqe->user_data = (uint64_t)(uintptr_t)conn | OP_SEND;
+	conn->send_armed = TRUE;
+}
+
+void uring_recv(uring_t *ring, cconn_t *conn) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+
+	uring_prep_recv(sqe, conn->sockid, conn->rx_buf, MAX_BUFF);
+	sqe->user_data = (uint64_t)(uintptr_t)conn | OP_RECV;
+}
+
+// Same window as run_epoll: every association always has a recv posted and
+// one send at a time, so the messages go out in order, until the window is
+// full. A whole batch of them costs a single io_uring_enter.
+void run_uring(worker_t *w) {
+	int ret, live;
+	uint64_t ud;
+	uring_t ring;
+	cconn_t *conn;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+
+	uint8_t *rx_bufs;
+
+	if (target_rate || loss_timeout || control_every || interleave || batch_size) {
+		TRACE_INFO("The open loop, lost messages, traffic mixes, interleaving and batching "
+					"are only handled on epoll, not using io_uring\n");
+		run_epoll(w);
+		return;
+	}
+
+	// The recvs complete asynchronously, every association needs a buffer
+	rx_bufs = malloc((size_t)w->nb_conns * MAX_BUFF);
+	if (rx_bufs == NULL || uring_init(&ring, URING_ENTRIES) == FALSE) {
+		TRACE_ERROR("Unable to set up io_uring, falling back to epoll\n");
+		free(rx_bufs);
+		run_epoll(w);
+		return;
+	}
+	for (int i = 0; i < w->nb_conns; i++) w->conns[i].rx_buf = rx_bufs + (size_t)i * MAX_BUFF;
+
+	sqe = get_sqe(&ring);
+	uring_prep_poll_add(sqe, w->wake_fd, POLLIN);
+	sqe->user_data = OP_WAKE;
+
+	live = 0;
+	for (int i = 0; i < w->nb_conns; i++) {
+		if (w->conns[i].sockid == -1) continue;
+		uring_recv(&ring, &w->conns[i]);
+		uring_send(&ring, &w->conns[i]);
+		live++;
+	}
+#ifdef RATE
+	w->now = nano_ts();
+	w->tx_start_ts = w->rx_start_ts = w->now;
+#endif
+
+	while (!force_quit && live) {
+		uring_submit_and_wait(&ring, 1);
 #ifdef RATE
-		if (stats->rx == 0) rx_start_ts = micro_ts();
+		w->now = nano_ts();
+#endif
+		while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+			ud = cqe->user_data;
+			ret = cqe->res;
+			conn = (cconn_t *)(uintptr_t)(ud & ~(uint64_t)OP_MASK);
+			uring_cqe_seen(&ring);
+
+			switch (ud & OP_MASK) {
+				case OP_SEND:
+					conn->send_armed = FALSE;
+					if (conn->sockid == -1) break;
+					if (ret < 0) {
+						// The shutdown ends the posted recv, which closes
+						TRACE_ERROR("An error occur red while writing to server\n");
+						shutdown(conn->sockid, SHUT_RDWR);
+						break;
+					}
+					conn->sent += ret;
+					count(&w->stats.io.tx, ret);
+#ifdef RATE
+					w->tx_end_ts = w->now;
+#endif
+					if (conn->sent == msg_len(conn)) msg_written(conn);
+					if (conn->inflight < window) uring_send(&ring, conn);
+					break;
+				case OP_RECV:
+					if (ret <= 0) {
+						if (ret == 0) {
+							TRACE_ERROR("The connection closed from the server side, exiting\n");
+						} else {
+							TRACE_ERROR("An error occured while reading from server\n");
+						}
+						close_cconn(conn);
+						live--;
+						break;
+					}
+					count(&w->stats.io.rx, ret);
+#ifdef RATE
+					w->rx_end_ts = w->now;
+#endif
+					recv_fixed(conn, conn->rx_buf, ret);
+					uring_recv(&ring, conn);
+					if (!conn->send_armed && conn->inflight < window) uring_send(&ring, conn);
+					break;
+			}
+		}
+	}
+	uring_exit(&ring);
+	free(rx_bufs);
+}
+
+// Starts the handshake of a new association in the slot, the socket turns
+// writable once it is done. A handshake that can't even start counts as
+// failed, every retry again.
+int storm_connect(cconn_t *conn) {
+	struct sockaddr_in servaddr;
+
+	// Nonblocking from the start, one fcntl less per association
+	conn->sockid = open_socket(SOCK_NONBLOCK);
+	if (conn->sockid == -1) goto socket_failed;
+
+	server_addr(&servaddr);
+	conn->connect_ts = nano_ts();
+	if (connect(conn->sockid, (struct sockaddr *)&servaddr, sizeof(servaddr)) == -1 &&
+			errno != EINPROGRESS) {
+		TRACE_DEBUG("Unable to connect to the server, error: %s\n", strerror(errno));
+		goto failed_return;
+	}
+	if (set_events(conn, EPOLLOUT) == FALSE) goto failed_return;
+	return TRUE;
+
+failed_return:
+	close(conn->sockid);
+	conn->sockid = -1;
+socket_failed:
+	conn->worker->stats.failed++;
+	return FALSE;
+}
+
+// Records how the handshake went and closes the association right away,
+// the shutdown goes on in the kernel
+void storm_done(cconn_t *conn) {
+	worker_t *w = conn->worker;
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (getsockopt(conn->sockid, SOL_SOCKET, SO_ERROR, &err, &len) == -1) err = errno;
+	if (err == 0) {
+		hist_record(w->handshake, nano_ts() - conn->connect_ts);
+		count(&w->stats.io.msgs, 1);
+	} else {
+		TRACE_DEBUG("Handshake on %d failed, error: %s\n", conn->sockid, strerror(err));
+		w->stats.failed++;
+	}
+	// Closing drops it from the epoll as well
+	close(conn->sockid);
+	conn->sockid = -1;
+	conn->events = 0;
+}
+
+// Keeps a handshake in flight on every slot until force_quit, the next one
+// starts as soon as the last one is done
+void run_storm(worker_t *w) {
+	int nb_ev, down = 0;
+	cconn_t *conn;
+	struct epoll_event ev[BURST_SIZE];
+
+	w->storm_start_ts = nano_ts();
+	for (int i = 0; i < w->nb_conns; i++) {
+		w->conns[i].worker = w;
+		if (storm_connect(&w->conns[i]) == FALSE) down++;
+	}
+
+	while (!force_quit) {
+		nb_ev = epoll_wait(w->epoll_fd, ev, BURST_SIZE, down ? STORM_RETRY_MS : -1);
+		for (int i = 0; i < nb_ev; i++) {
+			conn = (cconn_t *)ev[i].data.ptr;
+			// Only the wake eventfd is registered without a connection
+			if (conn == NULL) continue;
+
+			storm_done(conn);
+			if (force_quit) break;
+			if (storm_connect(conn) == FALSE) down++;
+		}
+
+		// Out of ports or fds, or the server is not there yet
+		for (int i = 0; down && i < w->nb_conns && !force_quit; i++) {
+			if (w->conns[i].sockid != -1) continue;
+			if (storm_connect(&w->conns[i]) == TRUE) down--;
+		}
+	}
+	w->storm_end_ts = nano_ts();
+}
+
+void* run_worker(void *arg) {
+	worker_t *w = (worker_t *)arg;
+	struct epoll_event ev;
+	char placement[320];
+
+	pin_thread(&worker_cpus, w->id);
+	describe_placement(placement, sizeof(placement));
+	TRACE_INFO("Worker %d is running on %s\n", w->id, placement);
+	trace_thread("worker", w->id);
+	if (storm) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wake_fd, &ev) == -1) {
+			TRACE_ERROR("Unable to add fd to epoll, epoll_ctl: %s\n", strerror(errno));
+			goto exit;
+		}
+		run_storm(w);
+		goto exit;
+	}
+
+	w->data = generate_msg(&w->pool, msg_size, &w->data_cap);
+	w->datalen = msg_size;
+	if (w->data == NULL) {
+		TRACE_ERROR("Unable to allocate the message\n");
+		goto exit;
+	}
+
+	for (int i = 0; i < w->nb_conns; i++) {
+		w->conns[i].worker = w;
+#ifdef LATENCY
+		w->conns[i].msg = bufpool_get(&w->pool, w->datalen, &w->data_cap);
+		if (w->conns[i].msg == NULL) {
+			TRACE_ERROR("Unable to allocate message buffer\n");
+			goto exit;
+		}
+		memcpy(w->conns[i].msg, w->data, w->datalen);
 #endif
-		r = SCTP_READ(sockid, buffer, datalen);
-		if (r <= 0) {
-			if (r == 0) {
-				TRACE_ERROR("The connection closed from the server side, exiting\n");
+		if (batch_size && batch_init(&w->conns[i].batch, &w->pool, batch_size) == FALSE) {
+			TRACE_ERROR("Unable to allocate the batch\n");
+			goto exit;
+		}
+		if (loss_timeout) {
+			w->conns[i].sent_ts = malloc(window * sizeof(nano_ts_t));
+			if (w->conns[i].sent_ts == NULL) {
+				TRACE_ERROR("Unable to allocate the send times\n");
 				goto exit;
-			} else if (errno != EAGAIN) {
-				TRACE_ERROR("An error occured while reading from server\n");
+			}
+		}
+		w->conns[i].sockid = create_connection();
+		if (w->conns[i].sockid == FALSE) {
+			w->conns[i].sockid = -1;
+		} else {
+			w->conns[i].nb_streams = negotiated_streams(w->conns[i].sockid);
+			w->conns[i].rx = calloc(w->conns[i].nb_streams, sizeof(rx_state_t));
+			if (w->conns[i].rx == NULL) {
+				TRACE_ERROR("Unable to allocate the receive state\n");
 				goto exit;
 			}
-			continue;
 		}
-#ifdef RATE
-		stats->rx += r;
-		rx_end_ts = micro_ts();
-#endif
+		if (force_quit) goto exit;
 	}
+
+	if (use_uring) {
+		run_uring(w);
+	} else {
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wake_fd, &ev) == -1) {
+			TRACE_ERROR("Unable to add fd to epoll, epoll_ctl: %s\n", strerror(errno));
+			goto exit;
+		}
+		run_epoll(w);
+	}
+
 exit:
-	close(sockid);
+	for (int i = 0; i < w->nb_conns; i++) {
+		close_cconn(&w->conns[i]);
+		free(w->conns[i].rx);
+		free(w->conns[i].sent_ts);
+		batch_free(&w->conns[i].batch, &w->pool);
+#ifdef LATENCY
+		if (w->conns[i].msg) bufpool_put(&w->pool, w->conns[i].msg, w->data_cap);
+#endif
+	}
 #ifdef RATE
-	double rx_elapsed = MICRO_TO_SEC(rx_end_ts - rx_start_ts);
-	double tx_elapsed = MICRO_TO_SEC(tx_end_ts - tx_start_ts);
-	stats->rx_rate = BYTES_TO_BITS(BYTES_TO_GB(stats->rx)) / rx_elapsed;
-	stats->tx_rate = BYTES_TO_BITS(BYTES_TO_GB(stats->tx)) / tx_elapsed;
+	double rx_elapsed = NANO_TO_SEC(w->rx_end_ts - w->rx_start_ts);
+	double tx_elapsed = NANO_TO_SEC(w->tx_end_ts - w->tx_start_ts);
+	w->stats.rx_rate = rx_elapsed > 0 ? BYTES_TO_BITS(BYTES_TO_GB(w->stats.io.rx)) / rx_elapsed : 0;
+	w->stats.tx_rate = tx_elapsed > 0 ? BYTES_TO_BITS(BYTES_TO_GB(w->stats.io.tx)) / tx_elapsed : 0;
+	w->stats.msg_rate = rx_elapsed > 0 ? w->stats.io.msgs / rx_elapsed : 0;
+#endif
+	if (w->data) bufpool_put(&w->pool, w->data, w->data_cap);
+	bufpool_destroy(&w->pool);
+	return NULL;
+}
+
+int init_worker(worker_t *w, int id, int nb_conns, int total_conns) {
+	memset(w, 0, sizeof(worker_t));
+	w->id = id;
+	w->nb_conns = nb_conns;
+
+	w->conns = calloc(nb_conns, sizeof(cconn_t));
+	if (w->conns == NULL) {
+		TRACE_ERROR("Unable to allocate %d connections\n", nb_conns);
+		goto conns_failed;
+	}
+	for (int i = 0; i < nb_conns; i++) w->conns[i].sockid = -1;
+
+	if (storm) {
+		w->handshake = calloc(1, sizeof(hist_t));
+		if (w->handshake == NULL) {
+			TRACE_ERROR("Unable to allocate the handshake histogram\n");
+			goto handshake_failed;
+		}
+	}
 
-#if 0
-	TRACE_INFO("The total time it took for rx: %0.4f sec\n", rx_elapsed);
-	TRACE_INFO("The total time it took for rx: %0.4f sec\n", tx_elapsed);
-	TRACE_INFO("Received %ld bytes and sent %ld bytes\n", stats->rx, stats->tx);
-	TRACE_INFO("RX rate: %0.4fGbps | TX rate: %0.4fGbps\n",
-				stats->rx_rate, stats->tx_rate);
+#ifdef LATENCY
+	w->rtt = calloc(nb_streams, sizeof(hist_t));
+	if (w->rtt == NULL) {
+		TRACE_ERROR("Unable to allocate the latency histograms\n");
+		goto rtt_failed;
+	}
 #endif
+
+	if (target_rate) {
+		w->backlog_size = BACKLOG_SIZE;
+		w->backlog = malloc(BACKLOG_SIZE * sizeof(nano_ts_t));
+		if (w->backlog == NULL) {
+			TRACE_ERROR("Unable to allocate the backlog\n");
+			goto backlog_failed;
+		}
+		w->rate = target_rate * nb_conns / total_conns;
+		w->seed[0] = id;
+		w->seed[1] = id >> 16;
+		w->seed[2] = 0x330e;
+	}
+
+	w->epoll_fd = epoll_create(BURST_SIZE);
+	if (w->epoll_fd == -1) {
+		TRACE_ERROR("Unable to create epoll, epoll: %s\n", strerror(errno));
+		goto epoll_failed;
+	}
+
+	w->wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (w->wake_fd == -1) {
+		TRACE_ERROR("Unable to create eventfd, eventfd: %s\n", strerror(errno));
+		goto eventfd_failed;
+	}
+	return TRUE;
+
+eventfd_failed:
+	close(w->epoll_fd);
+epoll_failed:
+	free(w->backlog);
+backlog_failed:
+#ifdef LATENCY
+	free(w->rtt);
+rtt_failed:
 #endif
+	free(w->handshake);
+handshake_failed:
+	free(w->conns);
+conns_failed:
+	return FALSE;
 }
 
-void* run_client(void *arg) {
-	int sockid;
-	client_stats_t *stats = (client_stats_t *)arg;
-	stats->rx = stats->tx = 0;
-	stats->rx_rate = stats->tx_rate = 0;
+// Undoes init_worker for a worker whose thread never ran
+void free_worker(worker_t *w) {
+	close(w->wake_fd);
+	close(w->epoll_fd);
+	free(w->backlog);
+#ifdef LATENCY
+	free(w->rtt);
+#endif
+	free(w->handshake);
+	free(w->conns);
+}
 
-	sockid = create_connection();
-	if (sockid == FALSE) return NULL;
+void print_open_loop(worker_t *workers, int nb_workers) {
+	size_t peak = 0, left = 0;
 
-	handle_connection(sockid, stats);
-	close(sockid);
+	for (int i = 0; i < nb_workers; i++) {
+		if (workers[i].backlog_peak > peak) peak = workers[i].backlog_peak;
+		left += workers[i].backlog_tail - workers[i].backlog_head;
+	}
+	TRACE_INFO("Open loop at %0.1f messages per second with %s arrivals\n", target_rate,
+				arrival == ARRIVAL_POISSON ? "poisson" : "constant");
+	TRACE_INFO("Largest backlog of a worker: %ld | Never sent: %ld\n", peak, left);
+}
 
-	return NULL;
+void print_batching(worker_t *workers, int nb_workers) {
+	size_t msgs = 0, batches = 0;
+
+	for (int i = 0; i < nb_workers; i++) {
+		msgs += workers[i].stats.io.msgs;
+		batches += workers[i].stats.batches;
+	}
+	TRACE_INFO("Batches of up to %ld bytes, written after at most %ldus%s\n", batch_size,
+				(long)(batch_delay / (NSEC_PER_SEC / 1000000)), nodelay ? ", nodelay" : "");
+	TRACE_INFO("Batches written: %ld | Messages per batch: %0.1f\n", batches,
+				batches ? (double)msgs / batches : 0);
+}
+
+void print_loss(worker_t *workers, int nb_workers) {
+	char policy[64];
+	size_t msgs = 0, lost = 0, late = 0;
+	abandoned_t abandoned = {0, 0};
+
+	for (int i = 0; i < nb_workers; i++) {
+		msgs += workers[i].stats.io.msgs;
+		lost += workers[i].stats.lost;
+		late += workers[i].stats.late;
+		abandoned.unsent += workers[i].stats.abandoned.unsent;
+		abandoned.sent += workers[i].stats.abandoned.sent;
+	}
+	policy_name(&send_policy, policy, sizeof(policy));
+	TRACE_INFO("Messages sent %s, lost after %ldms without echo\n", policy,
+				(long)(loss_timeout / (NSEC_PER_SEC / 1000)));
+	TRACE_INFO("Lost: %ld (%0.3f%%) | Echoed after they were lost: %ld\n", lost,
+				msgs + lost ? 100.0 * lost / (msgs + lost) : 0, late);
+	if (policy_partial(&send_policy)) {
+		TRACE_INFO("Abandoned messages: %ld unsent | %ld sent\n",
+					abandoned.unsent, abandoned.sent);
+	}
+}
+
+void print_hist(char *name, char *what, hist_t *h) {
+	TRACE_INFO("%s: %ld %s, min: %0.1f | mean: %0.1f | p50: %0.1f | p90: %0.1f | "
+				"p99: %0.1f | p99.9: %0.1f | max: %0.1f\n", name, h->total, what,
+				NANO_TO_MICRO(h->min), NANO_TO_MICRO(hist_mean(h)),
+				NANO_TO_MICRO(hist_percentile(h, 50)), NANO_TO_MICRO(hist_percentile(h, 90)),
+				NANO_TO_MICRO(hist_percentile(h, 99)), NANO_TO_MICRO(hist_percentile(h, 99.9)),
+				NANO_TO_MICRO(h->max));
 }
 
+void print_storm(worker_t *workers, int nb_workers) {
+	hist_t handshake;
+	size_t failed = 0;
+	double rate = 0, elapsed;
+	int inflight = 0;
+
+	memset(&handshake, 0, sizeof(handshake));
+	for (int i = 0; i < nb_workers; i++) {
+		hist_merge(&handshake, workers[i].handshake);
+		failed += workers[i].stats.failed;
+		inflight += workers[i].nb_conns;
+		elapsed = NANO_TO_SEC(workers[i].storm_end_ts - workers[i].storm_start_ts);
+		if (elapsed > 0) rate += workers[i].stats.io.msgs / elapsed;
+	}
+	TRACE_INFO("Association storm, %d handshakes in flight at a time\n", inflight);
+	TRACE_INFO("Associations: %ld | Associations per second: %0.1f | Failed handshakes: %ld\n",
+				handshake.total, rate, failed);
+	TRACE_INFO("Handshake time in microseconds:\n");
+	print_hist("Handshakes", "associations", &handshake);
+}
+
+#ifdef LATENCY
+void print_latency(worker_t *workers, int nb_workers) {
+	char name[32];
+	hist_t *rtt = calloc(nb_streams + 2, sizeof(hist_t));
+	hist_t *all = &rtt[nb_streams];
+	hist_t *bulk = &rtt[nb_streams + 1];
+
+	if (rtt == NULL) return;
+	for (int i = 0; i < nb_workers; i++) {
+		for (int s = 0; s < nb_streams; s++) hist_merge(&rtt[s], &workers[i].rtt[s]);
+	}
+	for (int s = 0; s < nb_streams; s++) hist_merge(all, &rtt[s]);
+	for (int s = 1; s < nb_streams; s++) hist_merge(bulk, &rtt[s]);
+
+	TRACE_INFO("Round trip time in microseconds:\n");
+	print_hist("All streams", "messages", all);
+	// The control messages are the ones on stream 0
+	if (control_every && nb_streams > 1) {
+		print_hist("Control", "messages", &rtt[0]);
+		print_hist("Bulk", "messages", bulk);
+	}
+	for (int s = 0; nb_streams > 1 && s < nb_streams; s++) {
+		snprintf(name, sizeof(name), "Stream %d", s);
+		print_hist(name, "messages", &rtt[s]);
+	}
+	free(rtt);
+}
+#endif
+
 void handle_sigint(int sig)  {
 	printf("Caught signal %d, going to quit!\n", sig);
 	force_quit = 1;
@@ -183,57 +1418,303 @@ void handle_sigint(int sig)  {
 void usage(char *prog) {
   fprintf(stderr,
   				"usage: %s \n"
-  				"	-n Number of clients, default is %d and maximum is %d\n"
+  				"	-n Number of clients (associations), default is %d and maximum is %d\n"
+  				"	-t Number of threads driving them, default is one per online CPU and "
+				"maximum is %d\n"
+				"	-s Streams to spread the messages of every association over, default is %d "
+				"and maximum is %d\n"
+				"	-w Messages in flight per association, default is %d and maximum is %d\n"
+				"	-R Open loop at this many messages per second over all associations, "
+				"default is closed loop\n"
+				"	-d Inter-arrival distribution of the open loop, const or poisson, "
+				"default is const\n"
+				"	-i Seconds between live rate reports, 0 turns them off, default is %d\n"
+				"	-o Send unordered\n"
+				"	-x Send partially reliable, ttl:<ms> gives up on a message that is not\n"
+				"	   delivered within that time, rtx:<n> after n retransmissions\n"
+				"	-L Milliseconds after which a message without echo is lost, default is "
+				"twice the ttl plus %d\n"
+				"	   with -x ttl, %d with -x rtx and never otherwise\n"
+				"	-l Size of the (bulk) messages, default is %d and maximum is %d\n"
+				"	   messages larger than the socket send buffer need net.sctp.sctp_wmem raised\n"
+				"	-I Interleave large messages with the others (I-DATA), delivering them in\n"
+				"	   pieces, needs net.sctp.intl_enable\n"
+				"	-c Traffic mix, every n-th message is a %d byte control message on stream 0,\n"
+				"	   the others are bulk on the other streams, needs -s 2 or more\n"
+				"	-S Stream scheduler of every association, fcfs, prio, rr, fc or wfq, followed\n"
+				"	   by :<value>,<value>... to give streams 0, 1, ... a priority (prio) or\n"
+				"	   weight (wfq), default is the kernel's\n"
+				"	-b <bytes>[:<us>] Pack the messages into SCTP messages of up to that many\n"
+				"	   bytes, at most %d. One is written once full, or that many microseconds\n"
+				"	   after its first message, by default as soon as nothing more can go in\n"
+				"	-C CPUs to pin the workers to in turn, like 0-3,8, default is none\n"
+				"	-M Take the buffers of every worker from its own NUMA node\n"
+				"	-D Network interface to check the placement against, prints its node and\n"
+				"	   the CPUs of its interrupts and RPS, and which worker CPUs share them\n"
+				"	-N Set SCTP_NODELAY, messages are not bundled into packets by the stack\n"
+				"	-H Back the message buffers with huge pages\n"
+				"	-F Config file with tuning profiles, see tune.conf\n"
+				"	-K Tuning profile of every association, default, low-latency, bulk or one\n"
+				"	   of the config file, default is default\n"
+				"	-a Server address, default is %s\n"
+				"	-u Use io_uring instead of epoll\n"
+				"	-E Association storm, every association is closed as soon as its handshake\n"
+				"	   is done and a new one opened, reports the associations per second and\n"
+				"	   the handshake time. The live reports count associations as messages.\n"
+				"	-g Record the hot path events into this file, on exit and on SIGUSR1,\n"
+				"	   SIGUSR2 pauses and resumes the recording, see tracedump\n"
+				"	-T Measure the cost of every clock source and exit\n"
 				"	-h This help text\n",
-				prog, DEAFULT_CLIENTS, MAX_CPUS);
+				prog, DEAFULT_CLIENTS, MAX_CLIENTS, MAX_CPUS, DEFAULT_STREAMS, MAX_STREAMS, DEFAULT_WINDOW, MAX_WINDOW,
+				DEFAULT_REPORT_INTERVAL, LOSS_SLACK, DEFAULT_LOSS_TIMEOUT, MAX_BUFF, MAX_MSG,
+				CONTROL_SIZE, MAX_BATCH, DST_ADDR);
   exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[]) {
-	int opt, n;
-	pthread_t threads[MAX_CPUS];
-	client_stats_t stats[MAX_CPUS];
+	int opt, n, t, started, streams_set = FALSE;
+	long loss_ms = -1;
+	char *end, *tune_file = NULL, *profile = NULL, *trace_file = NULL, *ifname = NULL;
+	char profile_desc[256];
+	bufpool_t pools;
+	uint64_t one = 1;
+	worker_t *workers;
+	sigset_t sigset, oldset;
+#ifdef RATE
+	reporter_t reporter;
+	counters_t *counters[MAX_CPUS];
+	int reporting = FALSE;
+#endif
 
 	n = DEAFULT_CLIENTS;
-	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+	t = sysconf(_SC_NPROCESSORS_ONLN);
+	if (t < 1) t = 1;
+	if (t > MAX_CPUS) t = MAX_CPUS;
+	while ((opt = getopt(argc, argv, "n:t:s:w:R:d:ox:L:l:Ic:S:b:C:MD:NHF:K:i:a:g:uETh")) != -1) {
 		switch(opt) {
 			case 'n':
 				n = atoi(optarg);
-				if (n < 0 || n > MAX_CPUS) usage(argv[0]);
+				if (n < 0 || n > MAX_CLIENTS) usage(argv[0]);
+				break;
+			case 't':
+				t = atoi(optarg);
+				if (t < 1 || t > MAX_CPUS) usage(argv[0]);
+				break;
+			case 's':
+				nb_streams = atoi(optarg);
+				if (nb_streams < 1 || nb_streams > MAX_STREAMS) usage(argv[0]);
+				streams_set = TRUE;
+				break;
+			case 'w':
+				window = atoi(optarg);
+				if (window < 1 || window > MAX_WINDOW) usage(argv[0]);
+				break;
+			case 'R':
+				target_rate = atof(optarg);
+				if (target_rate <= 0) usage(argv[0]);
+				break;
+			case 'd':
+				if (strcmp(optarg, "const") == 0) arrival = ARRIVAL_CONSTANT;
+				else if (strcmp(optarg, "poisson") == 0) arrival = ARRIVAL_POISSON;
+				else usage(argv[0]);
+				break;
+			case 'o':
+				send_policy.flags |= SCTP_UNORDERED;
+				break;
+			case 'x':
+				if (parse_policy(optarg, &send_policy) == FALSE) usage(argv[0]);
+				break;
+			case 'L':
+				loss_ms = atol(optarg);
+				if (loss_ms < 1) usage(argv[0]);
+				break;
+			case 'l':
+				msg_size = atoi(optarg);
+				if (msg_size < CONTROL_SIZE || msg_size > MAX_MSG) usage(argv[0]);
+				break;
+			case 'I':
+				interleave = TRUE;
+				break;
+			case 'c':
+				control_every = atoi(optarg);
+				if (control_every < 1) usage(argv[0]);
+				break;
+			case 'S':
+				if (parse_sched(optarg, &stream_sched) == FALSE) usage(argv[0]);
+				break;
+			case 'b':
+				batch_size = strtoul(optarg, &end, 10);
+				if (*end == ':') batch_delay = strtoul(end + 1, &end, 10) * (NSEC_PER_SEC / 1000000);
+				if (*end != '\0' || batch_size == 0 || batch_size > MAX_BATCH) usage(argv[0]);
+				break;
+			case 'C':
+				if (parse_cpu_list(optarg, &worker_cpus) == FALSE) usage(argv[0]);
+				break;
+			case 'M':
+				bufpool_local = TRUE;
+				break;
+			case 'D':
+				ifname = optarg;
+				break;
+			case 'N':
+				nodelay = TRUE;
+				break;
+			case 'H':
+				bufpool_hugepages = TRUE;
+				break;
+			case 'F':
+				tune_file = optarg;
+				break;
+			case 'K':
+				profile = optarg;
 				break;
+			case 'i':
+				report_interval = atoi(optarg);
+				if (report_interval < 0) usage(argv[0]);
+				break;
+			case 'a':
+				dst_addr = optarg;
+				break;
+			case 'g':
+				trace_file = optarg;
+				break;
+			case 'u':
+				use_uring = TRUE;
+				break;
+			case 'E':
+				storm = TRUE;
+				break;
+			case 'T':
+				timing_init();
+				timing_selftest();
+				exit(EXIT_SUCCESS);
 			case 'h':
 			default:
 				usage(argv[0]);
 				break;
 		}
 	}
+	if (t > n) t = n;
+	// The storm only sets associations up and tears them down
+	if (storm && use_uring) usage(argv[0]);
+	if (tune_file && tune_load(tune_file) == FALSE) exit(EXIT_FAILURE);
+	if (profile && tune_select(profile, &tuning) == FALSE) {
+		TRACE_ERROR("There is no tuning profile called %s\n", profile);
+		usage(argv[0]);
+	}
+	if (tuning.streams > 0 && !streams_set) nb_streams = MIN(tuning.streams, MAX_STREAMS);
+	if (control_every && nb_streams < 2) usage(argv[0]);
+	if (batch_size && msg_size + BATCH_HDR > batch_size) usage(argv[0]);
+	// The server may echo partially reliable too, so -L works on its own
+	if (loss_ms < 0 && SCTP_PR_TTL_ENABLED(send_policy.flags))
+		loss_ms = 2 * (long)send_policy.value + LOSS_SLACK;
+	if (loss_ms < 0 && SCTP_PR_RTX_ENABLED(send_policy.flags)) loss_ms = DEFAULT_LOSS_TIMEOUT;
+	if (loss_ms > 0) loss_timeout = loss_ms * (NSEC_PER_SEC / 1000);
 
+	timing_init();
 	signal(SIGINT, handle_sigint);
+	if (ifname) print_irq_hints(ifname, &worker_cpus);
+	if (trace_file) trace_init(trace_file);
 
-	for (int i = 0; i < n; i++) {
-		pthread_create(threads + i, NULL, run_client, (void *)(stats + i));
+	// Their stats have to start on a cache line of their own
+	if (posix_memalign((void **)&workers, CACHE_LINE, t * sizeof(worker_t)) != 0) {
+		TRACE_ERROR("Unable to allocate %d workers\n", t);
+		exit(EXIT_FAILURE);
 	}
+	memset(workers, 0, t * sizeof(worker_t));
 
-	for (int i = 0; i < n; i++) {
-		pthread_join(threads[i], NULL);
+	// Only the main thread should handle SIGINT and the trace signals, the
+	// workers are woken up explicitly through their eventfd
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGUSR1);
+	sigaddset(&sigset, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+
+	// Spread the associations as evenly as possible over the workers
+	for (started = 0; started < t; started++) {
+		if (init_worker(&workers[started], started, n / t + (started < n % t), n) == FALSE) break;
+		if (pthread_create(&workers[started].thread, NULL, run_worker, &workers[started]) != 0) {
+			TRACE_ERROR("Unable to start worker %d\n", started);
+			free_worker(&workers[started]);
+			break;
+		}
+	}
+#ifdef RATE
+	if (report_interval) {
+		for (int i = 0; i < started; i++) counters[i] = &workers[i].stats.io;
+		reporting = start_reporter(&reporter, counters, started, report_interval);
+	}
+#endif
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (storm) {
+		TRACE_INFO("Started %d workers for %d handshakes at a time\n", started, n);
+	} else {
+		TRACE_INFO("Started %d workers for %d associations\n", started, n);
+	}
+
+	if (started == t) {
+		while (!force_quit) {
+			pause();
+			trace_poll();
+		}
+	}
+	force_quit = 1;
+
+	for (int i = 0; i < started; i++) {
+		if (write(workers[i].wake_fd, &one, sizeof(one)) == -1)
+			TRACE_ERROR("Unable to wake worker %d, error: %s\n", i, strerror(errno));
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].wake_fd);
+		close(workers[i].epoll_fd);
+		free(workers[i].conns);
+		free(workers[i].backlog);
 	}
 
 #ifdef RATE
-	size_t rx, tx;
-	double rx_rate, tx_rate;
-	rx = tx = 0;
-	rx_rate = tx_rate = 0;
+	if (reporting) stop_reporter(&reporter);
+
+	size_t rx, tx, msgs;
+	double rx_rate, tx_rate, msg_rate;
+	rx = tx = msgs = 0;
+	rx_rate = tx_rate = msg_rate = 0;
 
-	for (int i = 0; i < n; i++) {
-		rx += stats[i].rx;
-		tx += stats[i].tx;
-		rx_rate += stats[i].rx_rate;
-		tx_rate += stats[i].tx_rate;
+	for (int i = 0; i < started; i++) {
+		rx += workers[i].stats.io.rx;
+		tx += workers[i].stats.io.tx;
+		rx_rate += workers[i].stats.rx_rate;
+		tx_rate += workers[i].stats.tx_rate;
+		msgs += workers[i].stats.io.msgs;
+		msg_rate += workers[i].stats.msg_rate;
 	}
 	TRACE_INFO("In summary:\n");
-	TRACE_INFO("Received %ld bytes and sent %ld bytes\n", rx, tx);
-	TRACE_INFO("RX rate: %0.4fGbps | TX rate: %0.4fGbps\n", rx_rate, tx_rate);
+	if (!storm) {
+		TRACE_INFO("Received %ld bytes and sent %ld bytes\n", rx, tx);
+		TRACE_INFO("RX rate: %0.4fGbps | TX rate: %0.4fGbps\n", rx_rate, tx_rate);
+		TRACE_INFO("Window depth: %d | Messages: %ld | Messages per second: %0.1f\n",
+					window, msgs, msg_rate);
+	}
+#endif
+	tune_describe(&tuning, profile_desc, sizeof(profile_desc));
+	TRACE_INFO("Tuning profile: %s\n", profile_desc);
+	memset(&pools, 0, sizeof(pools));
+	for (int i = 0; i < started; i++) bufpool_sum(&pools, &workers[i].pool);
+	bufpool_print("Buffer pools", &pools);
+	if (batch_size) print_batching(workers, started);
+	if (target_rate) print_open_loop(workers, started);
+	if (loss_timeout || send_policy.flags) print_loss(workers, started);
+	if (storm) {
+		print_storm(workers, started);
+		for (int i = 0; i < started; i++) free(workers[i].handshake);
+	}
+#ifdef LATENCY
+	if (!storm) print_latency(workers, started);
+	for (int i = 0; i < started; i++) free(workers[i].rtt);
 #endif
 
+	free(workers);
+	trace_exit();
 	exit(EXIT_SUCCESS);
 }
@@ -1,6 +1,10 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <stdint.h>
+
+#include "timing.h"
+
 #ifndef TRUE
 #define TRUE (1)
 #endif
@@ -9,18 +13,27 @@
 #define FALSE (0)
 #endif
 
-#define SEC_TO_MICRO(sec) ((sec) * 1e6)
-#define MICRO_TO_SEC(micro) ((micro) * 1e-6)
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
 
 #define BYTES_TO_BITS(bytes) ((bytes) * 8)
 #define BYTES_TO_GB(bytes) ((bytes) * 1e-9)
 
 #define SCTP_READ(sockid, msg, len)	 sctp_recvmsg(sockid, msg, len, NULL, 0, NULL, NULL)
-#define SCTP_WRITE(sockid, msg, len) sctp_sendmsg(sockid, msg, len, NULL, 0, 0, 0, 0, 0, 0);
-
-typedef double micro_ts_t;
-
-// Returns current timestamp in microseconds
-micro_ts_t micro_ts();
+#define SCTP_WRITE(sockid, msg, len) sctp_sendmsg(sockid, msg, len, NULL, 0, 0, 0, 0, 0, 0)
+// Sends on the given stream with the ordering and reliability of a
+// send_policy_t
+#define SCTP_WRITE_STREAM(sockid, msg, len, stream, policy) \
+	sctp_sendmsg(sockid, msg, len, NULL, 0, 0, (policy)->flags, stream, (policy)->value, 0)
+// Same as above but with the association/stream information, needed on
+// one-to-many sockets
+#define SCTP_READ_INFO(sockid, msg, len, sinfo, flags) \
+	sctp_recvmsg(sockid, msg, len, NULL, 0, sinfo, flags)
+#define SCTP_WRITE_INFO(sockid, msg, len, sinfo) sctp_send(sockid, msg, len, sinfo, 0)
 
 #endif /* COMMON_H_ */
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include <math.h>
+
+#include "hist.h"
+
+// Largest value that falls into the bucket
+static uint64_t bucket_upper(unsigned int b) {
+	int shift;
+
+	if (b < HIST_SUB_BUCKETS) return b;
+	shift = b / HIST_SUB_BUCKETS - 1;
+	return (((uint64_t)(b % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS) + 1) << shift) - 1;
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+	if (src->total == 0) return;
+
+	for (int i = 0; i < HIST_BUCKETS; i++) dst->counts[i] += src->counts[i];
+	if (dst->total == 0 || src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+	dst->total += src->total;
+	dst->sum += src->sum;
+}
+
+uint64_t hist_percentile(const hist_t *h, double p) {
+	uint64_t target, seen = 0;
+	uint64_t v;
+
+	if (h->total == 0) return 0;
+	target = ceil(p / 100 * h->total);
+	if (target == 0) target = 1;
+
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen < target) continue;
+
+		v = bucket_upper(i);
+		if (v > h->max) v = h->max;
+		if (v < h->min) v = h->min;
+		return v;
+	}
+	return h->max;
+}
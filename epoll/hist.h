@@ -0,0 +1,48 @@
+#ifndef HIST_H_
+#define HIST_H_
+
+#include <stdint.h>
+
+// Log-linear histogram: values below HIST_SUB_BUCKETS get a bucket each,
+// above that every power of two is split into HIST_SUB_BUCKETS linear
+// buckets, so any value is recorded within 1/HIST_SUB_BUCKETS of itself
+#define HIST_SUB_BITS (7)
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+typedef struct hist {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+} hist_t;
+
+static inline unsigned int hist_bucket(uint64_t v) {
+	int shift;
+
+	if (v < HIST_SUB_BUCKETS) return v;
+	shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB_BUCKETS + (v >> shift) - HIST_SUB_BUCKETS;
+}
+
+static inline void hist_record(hist_t *h, uint64_t v) {
+	h->counts[hist_bucket(v)]++;
+	if (h->total == 0 || v < h->min) h->min = v;
+	if (v > h->max) h->max = v;
+	h->total++;
+	h->sum += v;
+}
+
+static inline double hist_mean(const hist_t *h) {
+	return h->total ? h->sum / h->total : 0;
+}
+
+// Adds every sample of src to dst
+void hist_merge(hist_t *dst, const hist_t *src);
+
+// Returns the value at or below which p percent of the samples are, as the
+// upper bound of its bucket
+uint64_t hist_percentile(const hist_t *h, double p);
+
+#endif /* HIST_H_ */
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "outq.h"
+
+static outq_msg_t *next_slot(outq_t *q) {
+	if (outq_full(q)) return NULL;
+	if (q->slots == NULL) {
+		q->slots = (outq_msg_t *)bufpool_get(q->pool, OUTQ_SLOTS * sizeof(outq_msg_t), &q->slots_cap);
+		if (q->slots == NULL) return NULL;
+		memset(q->slots, 0, OUTQ_SLOTS * sizeof(outq_msg_t));
+	}
+	return &q->slots[q->tail % OUTQ_SLOTS];
+}
+
+static void commit_slot(outq_t *q, outq_msg_t *msg, size_t len, uint16_t stream) {
+	msg->len = len;
+	msg->off = 0;
+	msg->stream = stream;
+	q->tail++;
+	q->bytes += len;
+}
+
+int outq_push(outq_t *q, const uint8_t *data, size_t len, uint16_t stream) {
+	outq_msg_t *msg = next_slot(q);
+
+	if (msg == NULL) return FALSE;
+	msg->buf = bufpool_get(q->pool, len, &msg->cap);
+	if (msg->buf == NULL) return FALSE;
+	memcpy(msg->buf, data, len);
+	commit_slot(q, msg, len, stream);
+	return TRUE;
+}
+
+int outq_push_owned(outq_t *q, uint8_t *buf, size_t len, size_t cap, uint16_t stream) {
+	outq_msg_t *msg = next_slot(q);
+
+	if (msg == NULL) return FALSE;
+	msg->buf = buf;
+	msg->cap = cap;
+	commit_slot(q, msg, len, stream);
+	return TRUE;
+}
+
+void outq_consume(outq_t *q, size_t n) {
+	outq_msg_t *msg = outq_peek(q);
+
+	msg->off += n;
+	q->bytes -= n;
+	if (msg->off < msg->len) return;
+
+	bufpool_put(q->pool, msg->buf, msg->cap);
+	msg->buf = NULL;
+	msg->len = msg->off = 0;
+	q->head++;
+}
+
+void outq_clear(outq_t *q) {
+	while (!outq_empty(q)) {
+		outq_msg_t *msg = outq_peek(q);
+		outq_consume(q, msg->len - msg->off);
+	}
+	if (q->slots) bufpool_put(q->pool, (uint8_t *)q->slots, q->slots_cap);
+	q->slots = NULL;
+}
@@ -0,0 +1,76 @@
+#ifndef OUTQ_H_
+#define OUTQ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bufpool.h"
+
+// Maximum number of messages that can wait for the socket to become writable
+#define OUTQ_SLOTS (64)
+// Stop reading from a connection once this many bytes are queued ...
+#define OUTQ_HIGH_WATER (32 * 1024)
+// ... and start again once the queue drained below this
+#define OUTQ_LOW_WATER (8 * 1024)
+
+typedef struct outq_msg {
+	uint8_t *buf;
+	size_t len;
+	// Bytes of this message already handed to the socket
+	size_t off;
+	// Stream the message has to go out on
+	uint16_t stream;
+	// Size of the buffer from the pool
+	size_t cap;
+} outq_msg_t;
+
+// Bounded ring of messages that could not be written right away. The slots
+// are only allocated once something has to be queued, so idle associations
+// don't pay for them. Slots and messages come from the pool of the thread
+// the queue belongs to.
+typedef struct outq {
+	bufpool_t *pool;
+	outq_msg_t *slots;
+	size_t slots_cap;
+	unsigned int head;
+	unsigned int tail;
+	size_t bytes;
+} outq_t;
+
+static inline int outq_empty(outq_t *q) {
+	return q->head == q->tail;
+}
+
+static inline int outq_full(outq_t *q) {
+	return q->tail - q->head == OUTQ_SLOTS;
+}
+
+static inline int outq_above_high_water(outq_t *q) {
+	return q->bytes >= OUTQ_HIGH_WATER || outq_full(q);
+}
+
+static inline int outq_below_low_water(outq_t *q) {
+	return q->bytes < OUTQ_LOW_WATER && !outq_full(q);
+}
+
+static inline outq_msg_t *outq_peek(outq_t *q) {
+	return &q->slots[q->head % OUTQ_SLOTS];
+}
+
+// Copies len bytes of data at the tail of the queue, returns FALSE if the
+// queue is full or there is no buffer for the copy
+int outq_push(outq_t *q, const uint8_t *data, size_t len, uint16_t stream);
+
+// Queues buf, a buffer of the queue's pool, without copying it. It goes
+// back to the pool once written. Returns FALSE if the queue is full, buf
+// is then still the caller's.
+int outq_push_owned(outq_t *q, uint8_t *buf, size_t len, size_t cap, uint16_t stream);
+
+// Marks n more bytes of the head message as written and releases the
+// message once all of it has been written
+void outq_consume(outq_t *q, size_t n);
+
+// Releases every queued message and the slots
+void outq_clear(outq_t *q);
+
+#endif /* OUTQ_H_ */
@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "debug.h"
+#include "server.h"
+#include "affinity.h"
+
+int nb_workers = DEFAULT_WORKERS;
+nano_ts_t work_cost = 0;
+cpu_list_t worker_cpus;
+
+// The rings of a reactor, to and from every worker, and the replies it
+// took off the rings while it waited for room to hand over a message
+typedef struct pipe_side {
+	pipe_ring_t **out;
+	pipe_ring_t **in;
+	pipe_msg_t *stash;
+	size_t nb_stashed, stash_cap;
+} pipe_side_t;
+
+static pipe_worker_t *workers;
+static int nb_started;
+static reactor_t *pipe_reactors;
+static pipe_side_t *sides;
+static int nb_sides;
+// Taken by every acceptor
+static unsigned int next_worker;
+
+static void wake(int fd) {
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) == -1)
+		TRACE_ERROR("Unable to wake a thread up, error: %s\n", strerror(errno));
+}
+
+// Reads every byte of the message, like parsing it would, and burns the
+// rest of the work cost
+static void process(pipe_worker_t *w, pipe_msg_t *m, nano_ts_t start) {
+	uint64_t sum = 0, word;
+	size_t i;
+
+	for (i = 0; i + sizeof(word) <= m->len; i += sizeof(word)) {
+		memcpy(&word, m->buf + i, sizeof(word));
+		sum += word;
+	}
+	for (; i < m->len; i++) sum += m->buf[i];
+	w->checksum += sum;
+
+	while (nano_ts() - start < work_cost)
+		;
+}
+
+static int inbound_empty(pipe_worker_t *w) {
+	for (int i = 0; i < nb_sides; i++) {
+		if (!pipe_empty(sides[i].out[w->id])) return FALSE;
+	}
+	return TRUE;
+}
+
+static void *run_worker(void *arg) {
+	pipe_worker_t *w = (pipe_worker_t *)arg;
+	pipe_msg_t m;
+	reactor_t *r;
+	nano_ts_t now;
+	uint64_t events;
+	int got;
+	char placement[320];
+
+	pin_thread(&worker_cpus, w->id);
+	describe_placement(placement, sizeof(placement));
+	TRACE_INFO("Worker %d is running on %s\n", w->id, placement);
+	trace_thread("worker", w->id);
+
+	while (!force_quit) {
+		got = 0;
+		for (int i = 0; i < nb_sides; i++) {
+			r = &pipe_reactors[i];
+			while (pipe_pop(sides[i].out[w->id], &m)) {
+				now = nano_ts();
+				w->wait_ns += now - m.ts;
+				process(w, &m, now);
+
+				m.ts = nano_ts();
+				// The reactor takes the replies off while it waits for room
+				// on a ring to us, so this can't block forever
+				while (pipe_push(sides[i].in[w->id], &m) == FALSE) {
+					if (force_quit) return NULL;
+					sched_yield();
+				}
+				w->msgs++;
+				got++;
+
+				// Pairs with the reactor checking its rings after it set
+				// sleeping
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+				if (__atomic_load_n(&r->sleeping, __ATOMIC_RELAXED)) wake(r->wake_fd);
+			}
+		}
+		if (got) continue;
+
+		// Nothing to do, sleep until a reactor hands something over
+		__atomic_store_n(&w->sleeping, TRUE, __ATOMIC_SEQ_CST);
+		if (inbound_empty(w) && !force_quit) {
+			w->sleeps++;
+			if (read(w->wake_fd, &events, sizeof(events)) == -1 && errno != EINTR)
+				TRACE_ERROR("Worker %d is unable to sleep, error: %s\n", w->id, strerror(errno));
+		}
+		__atomic_store_n(&w->sleeping, FALSE, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static pipe_ring_t *new_ring() {
+	pipe_ring_t *ring;
+
+	if (posix_memalign((void **)&ring, CACHE_LINE, sizeof(pipe_ring_t)) != 0) return NULL;
+	memset(ring, 0, sizeof(pipe_ring_t));
+	return ring;
+}
+
+int pipeline_init(reactor_t *reactors, int nb_reactors) {
+	pipe_side_t *s;
+
+	pipe_reactors = reactors;
+	if (posix_memalign((void **)&workers, CACHE_LINE, nb_workers * sizeof(pipe_worker_t)) != 0) {
+		TRACE_ERROR("Unable to allocate %d workers\n", nb_workers);
+		return FALSE;
+	}
+	memset(workers, 0, nb_workers * sizeof(pipe_worker_t));
+
+	sides = calloc(nb_reactors, sizeof(pipe_side_t));
+	if (sides == NULL) goto failed_return;
+	nb_sides = nb_reactors;
+	for (int r = 0; r < nb_sides; r++) {
+		s = &sides[r];
+		s->out = calloc(nb_workers, sizeof(pipe_ring_t *));
+		s->in = calloc(nb_workers, sizeof(pipe_ring_t *));
+		if (s->out == NULL || s->in == NULL) goto failed_return;
+		for (int i = 0; i < nb_workers; i++) {
+			s->out[i] = new_ring();
+			s->in[i] = new_ring();
+			if (s->out[i] == NULL || s->in[i] == NULL) goto failed_return;
+		}
+	}
+
+	for (nb_started = 0; nb_started < nb_workers; nb_started++) {
+		workers[nb_started].id = nb_started;
+		// Blocking, a sleeping worker waits in read
+		workers[nb_started].wake_fd = eventfd(0, 0);
+		if (workers[nb_started].wake_fd == -1) {
+			TRACE_ERROR("Unable to create eventfd, eventfd: %s\n", strerror(errno));
+			goto failed_return;
+		}
+		if (pthread_create(&workers[nb_started].thread, NULL, run_worker, &workers[nb_started]) != 0) {
+			TRACE_ERROR("Unable to start worker %d\n", nb_started);
+			close(workers[nb_started].wake_fd);
+			goto failed_return;
+		}
+	}
+	TRACE_INFO("Started %d workers, %0.2fus of work per message\n",
+				nb_workers, NANO_TO_MICRO((double)work_cost));
+	return TRUE;
+
+failed_return:
+	force_quit = TRUE;
+	pipeline_stop();
+	pipeline_free();
+	return FALSE;
+}
+
+void pipeline_stop() {
+	for (int i = 0; i < nb_started; i++) wake(workers[i].wake_fd);
+	for (int i = 0; i < nb_started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].wake_fd);
+	}
+	nb_started = 0;
+}
+
+// What is still on the rings goes away with the reactors' pools
+void pipeline_free() {
+	for (int i = 0; i < nb_sides; i++) {
+		for (int w = 0; w < nb_workers; w++) {
+			if (sides[i].out) free(sides[i].out[w]);
+			if (sides[i].in) free(sides[i].in[w]);
+		}
+		free(sides[i].out);
+		free(sides[i].in);
+		free(sides[i].stash);
+	}
+	free(sides);
+	sides = NULL;
+	free(workers);
+	workers = NULL;
+}
+
+int pipeline_pick() {
+	return __atomic_fetch_add(&next_worker, 1, __ATOMIC_RELAXED) % nb_workers;
+}
+
+// Moves the replies waiting on the rings to the stash, without echoing
+// them, so the workers can go on. Returns FALSE if the stash can't grow.
+static int stash_replies(reactor_t *r) {
+	pipe_side_t *s = &sides[r->id];
+	pipe_msg_t *grown;
+	size_t cap;
+
+	for (int i = 0; i < nb_workers; i++) {
+		for (;;) {
+			if (s->nb_stashed == s->stash_cap) {
+				cap = s->stash_cap ? 2 * s->stash_cap : PIPE_RING_SIZE;
+				grown = realloc(s->stash, cap * sizeof(pipe_msg_t));
+				if (grown == NULL) {
+					TRACE_ERROR("Reactor %d is unable to stash %ld replies\n", r->id, cap);
+					return FALSE;
+				}
+				s->stash = grown;
+				s->stash_cap = cap;
+			}
+			if (pipe_pop(s->in[i], &s->stash[s->nb_stashed]) == FALSE) break;
+			s->nb_stashed++;
+		}
+	}
+	return TRUE;
+}
+
+int pipeline_push(reactor_t *r, conn_t *conn, uint8_t *buf, size_t len,
+				  uint16_t stream, size_t cap) {
+	pipe_msg_t m;
+	pipe_ring_t *ring = sides[r->id].out[conn->worker];
+	pipe_worker_t *w = &workers[conn->worker];
+
+	m.conn = conn;
+	m.buf = buf;
+	m.len = len;
+	m.cap = cap;
+	m.stream = stream;
+	m.ts = nano_ts();
+	if (pipe_push(ring, &m) == FALSE) {
+		r->stats.stalls++;
+		do {
+			// Without room for the replies the worker can't take this off
+			// the ring either
+			if (force_quit || stash_replies(r) == FALSE) {
+				bufpool_put(&r->pool, buf, cap);
+				return FALSE;
+			}
+			sched_yield();
+		} while (pipe_push(ring, &m) == FALSE);
+	}
+	conn->inflight++;
+	r->stats.handoffs++;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) wake(w->wake_fd);
+	return TRUE;
+}
+
+static void reply(reactor_t *r, pipe_msg_t *m, nano_ts_t now) {
+	conn_t *conn = m->conn;
+
+	r->stats.back_ns += now - m->ts;
+	conn->inflight--;
+	if (conn->closed) {
+		bufpool_put(&r->pool, m->buf, m->cap);
+		if (conn->inflight == 0) free(conn);
+		return;
+	}
+	if (handle_write(conn, m->buf, m->len, m->stream, m->cap) == FALSE) close_conn(conn);
+}
+
+int pipeline_collect(reactor_t *r) {
+	pipe_side_t *s = &sides[r->id];
+	pipe_msg_t m;
+	nano_ts_t now = nano_ts();
+	int n = 0;
+
+	// The stashed replies came off the rings first
+	for (size_t i = 0; i < s->nb_stashed; i++, n++) reply(r, &s->stash[i], now);
+	s->nb_stashed = 0;
+	for (int i = 0; i < nb_workers; i++) {
+		for (; pipe_pop(s->in[i], &m); n++) reply(r, &m, now);
+	}
+	return n;
+}
+
+int pipeline_pending(reactor_t *r) {
+	pipe_side_t *s = &sides[r->id];
+
+	if (s->nb_stashed) return TRUE;
+	for (int i = 0; i < nb_workers; i++) {
+		if (!pipe_empty(s->in[i])) return TRUE;
+	}
+	return FALSE;
+}
+
+void pipeline_print() {
+	size_t handoffs = 0, stalls = 0, msgs = 0, sleeps = 0;
+	nano_ts_t back_ns = 0, wait_ns = 0;
+
+	for (int i = 0; i < nb_sides; i++) {
+		handoffs += pipe_reactors[i].stats.handoffs;
+		stalls += pipe_reactors[i].stats.stalls;
+		back_ns += pipe_reactors[i].stats.back_ns;
+	}
+	for (int i = 0; i < nb_workers; i++) {
+		pipe_worker_t *w = &workers[i];
+
+		TRACE_INFO("Worker %d: %ld messages, %ld sleeps, %0.2fus on the ring per message\n",
+					i, w->msgs, w->sleeps, w->msgs ? NANO_TO_MICRO((double)w->wait_ns / w->msgs) : 0);
+		msgs += w->msgs;
+		sleeps += w->sleeps;
+		wait_ns += w->wait_ns;
+	}
+
+	TRACE_INFO("Pipeline: %d workers | Work per message: %0.2fus | Handed over: %ld | "
+				"Stalls on a full ring: %ld\n",
+				nb_workers, NANO_TO_MICRO((double)work_cost), handoffs, stalls);
+	TRACE_INFO("Handoff: %0.2fus to a worker | %0.2fus back | Worker sleeps per message: %0.4f\n",
+				msgs ? NANO_TO_MICRO((double)wait_ns / msgs) : 0,
+				msgs ? NANO_TO_MICRO((double)back_ns / msgs) : 0,
+				msgs ? (double)sleeps / msgs : 0);
+}
@@ -0,0 +1,122 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "timing.h"
+#include "affinity.h"
+
+// Pipeline mode: the reactors hand every message they read to a pool of
+// workers instead of echoing it themselves. Every reactor has a
+// single-producer single-consumer ring to every worker and one back, and
+// all the messages of a connection go through the same worker so their
+// echoes stay in order. The worker spends work_cost nanoseconds on the
+// message and returns it to the reactor, which echoes it.
+
+#define DEFAULT_WORKERS (0)
+#define MAX_WORKERS (64)
+// Messages per ring, a power of two
+#define PIPE_RING_SIZE (1024)
+
+struct conn;
+struct reactor;
+
+typedef struct pipe_msg {
+	struct conn *conn;
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+	uint16_t stream;
+	// When it was put on the ring, for the time spent in the handoff
+	nano_ts_t ts;
+} pipe_msg_t;
+
+// Head and tail are on cache lines of their own, and each side keeps a
+// copy of the other one's index so it only reads it when the ring looks
+// full or empty
+typedef struct pipe_ring {
+	size_t tail __attribute__((aligned(CACHE_LINE)));
+	size_t head_cache;
+	size_t head __attribute__((aligned(CACHE_LINE)));
+	size_t tail_cache;
+	pipe_msg_t slots[PIPE_RING_SIZE] __attribute__((aligned(CACHE_LINE)));
+} pipe_ring_t;
+
+typedef struct pipe_worker {
+	int id;
+	pthread_t thread;
+	// Written by a reactor that hands over a message while we sleep
+	int wake_fd;
+	int sleeping;
+
+	// Messages, sleeps, time the messages waited on the rings and a sum
+	// of their bytes, so the work can't be optimized away
+	size_t msgs;
+	size_t sleeps;
+	nano_ts_t wait_ns;
+	uint64_t checksum;
+} __attribute__((aligned(CACHE_LINE))) pipe_worker_t;
+
+extern int nb_workers;
+extern nano_ts_t work_cost;
+// CPUs the workers are pinned to, in turn
+extern cpu_list_t worker_cpus;
+
+// Only called by the producer
+static inline int pipe_push(pipe_ring_t *ring, const pipe_msg_t *m) {
+	size_t tail = ring->tail;
+
+	if (tail - ring->head_cache == PIPE_RING_SIZE) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (tail - ring->head_cache == PIPE_RING_SIZE) return FALSE;
+	}
+	ring->slots[tail & (PIPE_RING_SIZE - 1)] = *m;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return TRUE;
+}
+
+// Only called by the consumer
+static inline int pipe_pop(pipe_ring_t *ring, pipe_msg_t *m) {
+	size_t head = ring->head;
+
+	if (head == ring->tail_cache) {
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (head == ring->tail_cache) return FALSE;
+	}
+	*m = ring->slots[head & (PIPE_RING_SIZE - 1)];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return TRUE;
+}
+
+static inline int pipe_empty(pipe_ring_t *ring) {
+	return ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+// Sets up the rings between the reactors and the workers and starts the
+// workers
+int pipeline_init(struct reactor *reactors, int nb_reactors);
+// Stops the workers, before the reactors so they don't touch the buffers
+// of a reactor that is gone
+void pipeline_stop();
+// Frees the rings, once the reactors are gone too
+void pipeline_free();
+
+// Worker every new connection goes to, called by the acceptors
+int pipeline_pick();
+
+// Hands the message in buf over to the connection's worker, buf comes
+// from the reactor's pool and comes back with the reply
+int pipeline_push(struct reactor *r, struct conn *conn, uint8_t *buf, size_t len,
+				  uint16_t stream, size_t cap);
+// Echoes every reply the workers have for the reactor, returns how many
+// there were
+int pipeline_collect(struct reactor *r);
+// Whether any worker has a reply for the reactor
+int pipeline_pending(struct reactor *r);
+
+void pipeline_print();
+
+#endif /* PIPELINE_H_ */
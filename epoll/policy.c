@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "common.h"
+#include "policy.h"
+
+send_policy_t send_policy;
+stream_sched_t stream_sched = {
+	.sched = -1,
+};
+
+static const char *sched_names[] = {
+	[SCTP_SS_FCFS] = "fcfs",
+	[SCTP_SS_PRIO] = "prio",
+	[SCTP_SS_RR] = "rr",
+	[SCHED_FC] = "fc",
+	[SCHED_WFQ] = "wfq",
+};
+
+int parse_policy(const char *arg, send_policy_t *p) {
+	char *end;
+	long value;
+	uint16_t pr;
+
+	if (strncmp(arg, "ttl:", 4) == 0) pr = SCTP_PR_SCTP_TTL;
+	else if (strncmp(arg, "rtx:", 4) == 0) pr = SCTP_PR_SCTP_RTX;
+	else return FALSE;
+
+	value = strtol(arg + 4, &end, 10);
+	if (end == arg + 4 || *end != '\0' || value < 0 || value > UINT32_MAX) return FALSE;
+
+	SCTP_PR_SET_POLICY(p->flags, pr);
+	p->value = value;
+	return TRUE;
+}
+
+void policy_name(const send_policy_t *p, char *buf, size_t len) {
+	char *order = p->flags & SCTP_UNORDERED ? "unordered" : "ordered";
+
+	if (SCTP_PR_TTL_ENABLED(p->flags))
+		snprintf(buf, len, "%s, ttl %ums", order, p->value);
+	else if (SCTP_PR_RTX_ENABLED(p->flags))
+		snprintf(buf, len, "%s, at most %u retransmissions", order, p->value);
+	else
+		snprintf(buf, len, "%s, reliable", order);
+}
+
+int parse_sched(const char *arg, stream_sched_t *s) {
+	char *end;
+	const char *p;
+	size_t len;
+	long value;
+
+	p = strchr(arg, ':');
+	len = p ? (size_t)(p - arg) : strlen(arg);
+
+	s->sched = -1;
+	for (int i = 0; i < sizeof(sched_names) / sizeof(sched_names[0]); i++) {
+		if (strlen(sched_names[i]) == len && strncmp(arg, sched_names[i], len) == 0) s->sched = i;
+	}
+	if (s->sched == -1) return FALSE;
+
+	s->nb_values = 0;
+	while (p) {
+		if (s->nb_values == MAX_SCHED_VALUES) return FALSE;
+		value = strtol(p + 1, &end, 10);
+		if (end == p + 1 || (*end != ',' && *end != '\0') || value < 0 || value > UINT16_MAX)
+			return FALSE;
+		s->values[s->nb_values++] = value;
+		p = *end == ',' ? end : NULL;
+	}
+	return TRUE;
+}
+
+const char *sched_name(int sched) {
+	if (sched < 0) return "default";
+	return sched_names[sched];
+}
+
+int set_sched(int sockid, sctp_assoc_t assoc, const stream_sched_t *s) {
+	int ret;
+	struct sctp_assoc_value av;
+	struct sctp_stream_value sv;
+
+	if (s->sched < 0) return TRUE;
+
+	memset(&av, 0, sizeof(av));
+	av.assoc_id = assoc;
+	av.assoc_value = s->sched;
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_STREAM_SCHEDULER, &av, sizeof(av));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to use the %s stream scheduler, error: %s\n",
+					sched_name(s->sched), strerror(errno));
+		return FALSE;
+	}
+
+	for (int i = 0; i < s->nb_values; i++) {
+		memset(&sv, 0, sizeof(sv));
+		sv.assoc_id = assoc;
+		sv.stream_id = i;
+		sv.stream_value = s->values[i];
+		ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_STREAM_SCHEDULER_VALUE, &sv, sizeof(sv));
+		// The association may have fewer streams than there are values
+		if (ret == -1 && errno != EINVAL) {
+			TRACE_ERROR("Unable to set the scheduler value of stream %d, error: %s\n",
+						i, strerror(errno));
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+int enable_interleaving(int sockid, uint32_t pd_point) {
+	int ret, level = 2;
+	struct sctp_assoc_value av;
+
+	// I-DATA needs the pieces of every stream to be delivered mixed
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &level, sizeof(level));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to interleave fragments, error: %s\n", strerror(errno));
+		return FALSE;
+	}
+
+	memset(&av, 0, sizeof(av));
+	av.assoc_id = SCTP_FUTURE_ASSOC;
+	av.assoc_value = 1;
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_INTERLEAVING_SUPPORTED, &av, sizeof(av));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to enable I-DATA, is net.sctp.intl_enable set? error: %s\n",
+					strerror(errno));
+		return FALSE;
+	}
+
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_PARTIAL_DELIVERY_POINT, &pd_point, sizeof(pd_point));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to set the partial delivery point, error: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int enable_partial(int sockid) {
+	int ret;
+	struct sctp_assoc_value av;
+
+	memset(&av, 0, sizeof(av));
+	av.assoc_id = SCTP_FUTURE_ASSOC;
+	av.assoc_value = 1;
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_PR_SUPPORTED, &av, sizeof(av));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to enable PR-SCTP, error: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int set_nodelay(int sockid) {
+	int ret, one = 1;
+
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_NODELAY, &one, sizeof(one));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to set SCTP_NODELAY, error: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int set_busy_poll(int sockid, int usecs) {
+	int ret;
+
+	ret = setsockopt(sockid, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to set SO_BUSY_POLL, error: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int get_abandoned(int sockid, sctp_assoc_t assoc, abandoned_t *a) {
+	int ret;
+	struct sctp_prstatus status;
+	socklen_t len = sizeof(status);
+
+	memset(&status, 0, sizeof(status));
+	status.sprstat_assoc_id = assoc;
+	status.sprstat_policy = SCTP_PR_SCTP_ALL;
+	ret = getsockopt(sockid, IPPROTO_SCTP, SCTP_PR_ASSOC_STATUS, &status, &len);
+	if (ret == -1) {
+		TRACE_DEBUG("Unable to get the PR-SCTP status of %d, error: %s\n", sockid, strerror(errno));
+		return FALSE;
+	}
+	a->unsent += status.sprstat_abandoned_unsent;
+	a->sent += status.sprstat_abandoned_sent;
+	return TRUE;
+}
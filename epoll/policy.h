@@ -0,0 +1,92 @@
+#ifndef POLICY_H_
+#define POLICY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/sctp.h>
+
+// How every message is sent. The defaults, ordered and fully reliable, are
+// what sctp_sendmsg does with all-zero flags.
+typedef struct send_policy {
+	// SCTP_UNORDERED and the PR-SCTP policy, as sinfo_flags
+	uint16_t flags;
+	// Milliseconds to live with SCTP_PR_SCTP_TTL, retransmissions with
+	// SCTP_PR_SCTP_RTX, as sinfo_timetolive
+	uint32_t value;
+} send_policy_t;
+
+// The kernel's stream schedulers, fair capacity and weighted fair queueing
+// came after round robin and are missing from older headers
+#define SCHED_FC (SCTP_SS_RR + 1)
+#define SCHED_WFQ (SCTP_SS_RR + 2)
+// Streams a value can be given for, the others keep the kernel default
+#define MAX_SCHED_VALUES (64)
+
+// Stream scheduler of every association and the value of each stream:
+// the priority with prio, lower goes first, the weight with wfq
+typedef struct stream_sched {
+	// -1 leaves the scheduler alone
+	int sched;
+	uint16_t values[MAX_SCHED_VALUES];
+	int nb_values;
+} stream_sched_t;
+
+// Messages the stack gave up on, before or after putting them on the wire
+typedef struct abandoned {
+	size_t unsent;
+	size_t sent;
+} abandoned_t;
+
+extern send_policy_t send_policy;
+extern stream_sched_t stream_sched;
+
+static inline int policy_partial(const send_policy_t *p) {
+	return SCTP_PR_POLICY(p->flags) != SCTP_PR_SCTP_NONE;
+}
+
+static inline void policy_sinfo(const send_policy_t *p, struct sctp_sndrcvinfo *sinfo) {
+	sinfo->sinfo_flags |= p->flags;
+	sinfo->sinfo_timetolive = p->value;
+}
+
+// Parses ttl:<ms> or rtx:<retransmissions> into p, returns FALSE if arg is
+// neither
+int parse_policy(const char *arg, send_policy_t *p);
+
+// Human readable form of p, e.g. "unordered, ttl 100ms"
+void policy_name(const send_policy_t *p, char *buf, size_t len);
+
+// Parses <scheduler>[:<value>,<value>...] into s, the scheduler being one
+// of fcfs, prio, rr, fc or wfq and the values going to streams 0, 1, ...
+int parse_sched(const char *arg, stream_sched_t *s);
+
+const char *sched_name(int sched);
+
+// Sets the scheduler and the stream values on an association that is up,
+// assoc is ignored on one-to-one sockets
+int set_sched(int sockid, sctp_assoc_t assoc, const stream_sched_t *s);
+
+// Makes the associations of the socket negotiate I-DATA (RFC 8260), so a
+// large message doesn't hold back the small ones on other streams, and
+// delivers anything larger than pd_point in pieces as it arrives, mixing
+// the pieces of different streams. Has to be called before they are set up.
+int enable_interleaving(int sockid, uint32_t pd_point);
+
+// Makes sure the associations of the socket negotiate PR-SCTP, has to be
+// called before they are set up
+int enable_partial(int sockid);
+
+// Turns off the Nagle-like delay that lets the stack bundle small
+// messages into one packet, every message goes out right away
+int set_nodelay(int sockid);
+
+// Lets reads on the socket busy poll the device queue for up to usecs
+// before they sleep. Raising it above net.core.busy_read needs
+// CAP_NET_ADMIN.
+int set_busy_poll(int sockid, int usecs);
+
+// Adds what the stack abandoned on the association to a, assoc is ignored
+// on one-to-one sockets
+int get_abandoned(int sockid, sctp_assoc_t assoc, abandoned_t *a);
+
+#endif /* POLICY_H_ */
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "reasm.h"
+
+// Smallest buffer a message starts in, the pieces are rarely smaller
+#define REASM_MIN_CAP (4096)
+
+// The message state is small enough for the smallest buffers of the pool
+static reasm_msg_t *new_msg(reasm_t *r, uint16_t stream) {
+	size_t cap;
+	reasm_msg_t *m = (reasm_msg_t *)bufpool_get(r->pool, sizeof(reasm_msg_t), &cap);
+
+	if (m == NULL) return NULL;
+	memset(m, 0, sizeof(reasm_msg_t));
+	m->stream = stream;
+	return m;
+}
+
+static void free_msg(reasm_t *r, reasm_msg_t *m) {
+	bufpool_put(r->pool, (uint8_t *)m, BUFPOOL_MIN);
+}
+
+static reasm_msg_t **find_partial(reasm_t *r, uint16_t stream) {
+	reasm_msg_t **p = &r->partial;
+
+	while (*p && (*p)->stream != stream) p = &(*p)->next;
+	return p;
+}
+
+// Makes room for len more bytes in the message
+static int reserve(reasm_t *r, reasm_msg_t *m, size_t len) {
+	uint8_t *grown;
+
+	if (m->len + len <= m->cap) return TRUE;
+	if (m->len + len > REASM_MAX_MSG) return FALSE;
+	if (m->buf == NULL) {
+		m->buf = bufpool_get(r->pool, MAX(len, REASM_MIN_CAP), &m->cap);
+		return m->buf != NULL;
+	}
+	grown = bufpool_grow(r->pool, m->buf, &m->cap, m->len, m->len + len);
+	if (grown == NULL) return FALSE;
+	m->buf = grown;
+	return TRUE;
+}
+
+static void release(reasm_t *r, reasm_msg_t *m) {
+	if (m->buf) bufpool_put(r->pool, m->buf, m->cap);
+	free_msg(r, m);
+}
+
+uint8_t *reasm_tail(reasm_t *r, size_t *room) {
+	reasm_msg_t *m = r->partial;
+
+	if (m == NULL || m->next) return NULL;
+	// Close to the limit, the piece goes through a copy and fails there
+	if (reserve(r, m, MIN(REASM_READ_CHUNK, REASM_MAX_MSG - m->len)) == FALSE) return NULL;
+	if (m->len == m->cap) return NULL;
+	*room = m->cap - m->len;
+	return m->buf + m->len;
+}
+
+int reasm_add(reasm_t *r, uint16_t stream, const uint8_t *data, size_t len, int eor,
+			  reasm_msg_t **done) {
+	reasm_msg_t **p = find_partial(r, stream);
+	reasm_msg_t *m = *p;
+
+	*done = NULL;
+	if (m == NULL) {
+		m = new_msg(r, stream);
+		if (m == NULL) return FALSE;
+		*p = m;
+	}
+
+	// Read straight into its tail, nothing to copy
+	if (m->buf && data == m->buf + m->len) {
+		m->len += len;
+	} else {
+		if (reserve(r, m, len) == FALSE) goto failed;
+		memcpy(m->buf + m->len, data, len);
+		m->len += len;
+	}
+
+	if (eor) {
+		*p = m->next;
+		*done = m;
+	}
+	return TRUE;
+
+failed:
+	*p = m->next;
+	release(r, m);
+	return FALSE;
+}
+
+void reasm_done(reasm_t *r, reasm_msg_t *m) {
+	free_msg(r, m);
+}
+
+void reasm_drop(reasm_t *r, uint16_t stream) {
+	reasm_msg_t **p = find_partial(r, stream);
+	reasm_msg_t *m = *p;
+
+	if (m == NULL) return;
+	*p = m->next;
+	release(r, m);
+}
+
+void reasm_clear(reasm_t *r) {
+	while (r->partial) reasm_drop(r, r->partial->stream);
+}
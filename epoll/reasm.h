@@ -0,0 +1,61 @@
+#ifndef REASM_H_
+#define REASM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bufpool.h"
+
+// Largest message that is put back together, anything bigger is an error
+#define REASM_MAX_MSG BUFPOOL_MAX
+// Room a read straight into a message in progress gets at least
+#define REASM_READ_CHUNK (64 * 1024)
+
+// A message that came in pieces: it did not fit in one read, or it was
+// partially delivered. With fragment interleave the pieces of messages on
+// different streams arrive mixed, so a connection can have one of these in
+// progress per stream.
+typedef struct reasm_msg {
+	uint16_t stream;
+	// From the pool of the reassembly, grown as the pieces come in
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+	struct reasm_msg *next;
+} reasm_msg_t;
+
+typedef struct reasm {
+	reasm_msg_t *partial;
+	bufpool_t *pool;
+} reasm_t;
+
+// Nothing in progress, every piece with MSG_EOR is a whole message
+static inline int reasm_idle(reasm_t *r) {
+	return r->partial == NULL;
+}
+
+// Returns where to read the next piece so it doesn't have to be copied,
+// at the end of the message in progress with at least REASM_READ_CHUNK
+// bytes of room. NULL unless exactly one message is in progress, the
+// next piece is then as likely to be for any of them.
+uint8_t *reasm_tail(reasm_t *r, size_t *room);
+
+// Adds len bytes to the message in progress on the stream, in place if
+// they were read into its reasm_tail. If eor ends the message, it is
+// returned in done and its buffer belongs to the caller from then on,
+// to be given back to the pool once used, and done is given back with
+// reasm_done. Returns FALSE if the message got too big or could not be
+// allocated.
+int reasm_add(reasm_t *r, uint16_t stream, const uint8_t *data, size_t len, int eor,
+			  reasm_msg_t **done);
+
+void reasm_done(reasm_t *r, reasm_msg_t *m);
+
+// Drops the message in progress on the stream, e.g. when its partial
+// delivery was aborted
+void reasm_drop(reasm_t *r, uint16_t stream);
+
+// Drops every message in progress
+void reasm_clear(reasm_t *r);
+
+#endif /* REASM_H_ */
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+#include "report.h"
+
+static void *run_reporter(void *arg) {
+	reporter_t *r = (reporter_t *)arg;
+	struct timespec deadline;
+	counters_t now;
+	nano_ts_t ts, last_ts;
+	size_t rx, tx, msgs;
+	double elapsed, rate, min_rate, max_rate;
+	int tick = 0;
+
+	last_ts = nano_ts();
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->stop) {
+		deadline.tv_sec += r->interval;
+		// Only a stop ends the wait early, any other wakeup waits again for the
+		// same deadline so the sample isn't skipped.
+		while (!r->stop && pthread_cond_timedwait(&r->cond, &r->lock, &deadline) == 0);
+		if (r->stop) break;
+
+		ts = nano_ts();
+		elapsed = NANO_TO_SEC(ts - last_ts);
+		last_ts = ts;
+		tick++;
+
+		rx = tx = msgs = 0;
+		min_rate = max_rate = 0;
+		for (int i = 0; i < r->nb_src; i++) {
+			now.rx = __atomic_load_n(&r->src[i]->rx, __ATOMIC_RELAXED);
+			now.tx = __atomic_load_n(&r->src[i]->tx, __ATOMIC_RELAXED);
+			now.msgs = __atomic_load_n(&r->src[i]->msgs, __ATOMIC_RELAXED);
+
+			rx += now.rx - r->last[i].rx;
+			tx += now.tx - r->last[i].tx;
+			msgs += now.msgs - r->last[i].msgs;
+			rate = (now.msgs - r->last[i].msgs) / elapsed;
+			if (i == 0 || rate < min_rate) min_rate = rate;
+			if (i == 0 || rate > max_rate) max_rate = rate;
+			r->last[i] = now;
+		}
+
+		TRACE_INFO("[%4ds] RX rate: %0.4fGbps | TX rate: %0.4fGbps | Messages per second: "
+					"%0.1f | Per thread: min %0.1f, max %0.1f\n",
+					tick * r->interval, BYTES_TO_BITS(BYTES_TO_GB(rx)) / elapsed,
+					BYTES_TO_BITS(BYTES_TO_GB(tx)) / elapsed, msgs / elapsed,
+					min_rate, max_rate);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+int start_reporter(reporter_t *r, counters_t **src, int nb_src, int interval) {
+	pthread_condattr_t attr;
+
+	memset(r, 0, sizeof(reporter_t));
+	r->src = src;
+	r->nb_src = nb_src;
+	r->interval = interval;
+
+	r->last = calloc(nb_src, sizeof(counters_t));
+	if (r->last == NULL) {
+		TRACE_ERROR("Unable to allocate the reporter state\n");
+		return FALSE;
+	}
+
+	// The deadlines are on the monotonic clock, wall clock jumps should
+	// not skew the rates
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&r->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&r->lock, NULL);
+
+	if (pthread_create(&r->thread, NULL, run_reporter, r) != 0) {
+		TRACE_ERROR("Unable to start the reporter\n");
+		pthread_cond_destroy(&r->cond);
+		pthread_mutex_destroy(&r->lock);
+		free(r->last);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void stop_reporter(reporter_t *r) {
+	pthread_mutex_lock(&r->lock);
+	r->stop = TRUE;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	free(r->last);
+}
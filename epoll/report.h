@@ -0,0 +1,48 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "common.h"
+
+#define CACHE_LINE (64)
+
+// Seconds between two live reports
+#define DEFAULT_REPORT_INTERVAL (1)
+
+// Counters every I/O thread keeps for the live report. Only their own
+// thread writes them, the reporter samples them.
+typedef struct counters {
+	size_t rx;
+	size_t tx;
+	size_t msgs;
+} counters_t;
+
+// Single writer, so a plain add is enough, it only has to reach memory
+// in one piece for the reporter
+static inline void count(size_t *c, size_t n) {
+	__atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+typedef struct reporter {
+	pthread_t thread;
+	int interval;
+
+	counters_t **src;
+	// What every source looked like at the previous report
+	counters_t *last;
+	int nb_src;
+
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} reporter_t;
+
+// Starts a thread printing the rates of the nb_src counters every interval
+// seconds, along with the spread of the message rate between them. The
+// counters have to stay around until stop_reporter.
+int start_reporter(reporter_t *r, counters_t **src, int nb_src, int interval);
+void stop_reporter(reporter_t *r);
+
+#endif /* REPORT_H_ */
@@ -0,0 +1,422 @@
+#include <sys/epoll.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+
+#include "debug.h"
+#include "server.h"
+
+#define ASSOC_HASH_SIZE (4096)
+
+// Per association state on the one-to-many socket
+typedef struct assoc {
+	sctp_assoc_t id;
+	// Chain in the association hash table
+	struct assoc *next;
+
+	outq_t outq;
+	// Messages that arrive in pieces
+	reasm_t reasm;
+	int pending;
+	struct assoc *pending_next;
+
+	// Messages received since window_start, to find the hot associations
+	size_t window_msgs;
+	nano_ts_t window_start;
+} assoc_t;
+
+static assoc_t *assoc_tab[ASSOC_HASH_SIZE];
+static int nb_assocs, peak_assocs;
+
+// Associations with something in their outbound queue
+static assoc_t *pending;
+static int shared_events = EPOLLIN;
+static int shared_paused = FALSE;
+// Buffer of the shared pool the next message is read into
+static uint8_t *rx_buf;
+static size_t rx_cap;
+
+size_t nb_peeled = 0;
+
+static inline unsigned int assoc_hash(sctp_assoc_t id) {
+	return (unsigned int)id % ASSOC_HASH_SIZE;
+}
+
+assoc_t *find_assoc(sctp_assoc_t id, int create) {
+	assoc_t *a;
+
+	for (a = assoc_tab[assoc_hash(id)]; a; a = a->next) {
+		if (a->id == id) return a;
+	}
+	if (!create) return NULL;
+
+	a = calloc(1, sizeof(assoc_t));
+	if (a == NULL) {
+		TRACE_ERROR("Unable to allocate state for association %d\n", id);
+		return NULL;
+	}
+	a->id = id;
+	a->reasm.pool = &shared_pool;
+	a->outq.pool = &shared_pool;
+	a->next = assoc_tab[assoc_hash(id)];
+	assoc_tab[assoc_hash(id)] = a;
+
+	nb_assocs++;
+	if (nb_assocs > peak_assocs) peak_assocs = nb_assocs;
+	TRACE_DEBUG("Association %d is up, %d associations\n", id, nb_assocs);
+	return a;
+}
+
+void unlink_pending(assoc_t *a) {
+	assoc_t **p = &pending;
+
+	if (!a->pending) return;
+	while (*p != a) p = &(*p)->pending_next;
+	*p = a->pending_next;
+	a->pending = FALSE;
+}
+
+void drop_assoc(sctp_assoc_t id) {
+	assoc_t **p = &assoc_tab[assoc_hash(id)];
+	assoc_t *a;
+
+	while (*p && (*p)->id != id) p = &(*p)->next;
+	if (*p == NULL) return;
+
+	a = *p;
+	*p = a->next;
+	unlink_pending(a);
+	outq_clear(&a->outq);
+	reasm_clear(&a->reasm);
+	free(a);
+
+	nb_assocs--;
+	TRACE_DEBUG("Association %d is gone, %d associations\n", id, nb_assocs);
+}
+
+// Aborts an association we can't serve anymore, so the peer sees it fail
+// instead of getting the rest of a message echoed as a whole one
+void abort_assoc(assoc_t *a) {
+	struct sctp_sndrcvinfo sinfo;
+
+	memset(&sinfo, 0, sizeof(sinfo));
+	sinfo.sinfo_assoc_id = a->id;
+	sinfo.sinfo_flags = SCTP_ABORT;
+	if (SCTP_WRITE_INFO(server_sock, NULL, 0, &sinfo) < 0)
+		TRACE_ERROR("Unable to abort association %d, error: %s\n", a->id, strerror(errno));
+	drop_assoc(a->id);
+}
+
+void drop_all_assocs() {
+	for (int i = 0; i < ASSOC_HASH_SIZE; i++) {
+		while (assoc_tab[i]) drop_assoc(assoc_tab[i]->id);
+	}
+}
+
+void handle_notification(uint8_t *buffer, int len) {
+	union sctp_notification *sn = (union sctp_notification *)buffer;
+	struct sctp_assoc_change *sac;
+	assoc_t *a;
+
+	if (sn->sn_header.sn_type == SCTP_PARTIAL_DELIVERY_EVENT) {
+		a = find_assoc(sn->sn_pdapi_event.pdapi_assoc_id, FALSE);
+		if (a) handle_pd_event(&a->reasm, sn);
+		return;
+	}
+	if (sn->sn_header.sn_type != SCTP_ASSOC_CHANGE) return;
+
+	sac = &sn->sn_assoc_change;
+	switch (sac->sac_state) {
+		case SCTP_COMM_UP:
+			set_sched(server_sock, sac->sac_assoc_id, &stream_sched);
+			find_assoc(sac->sac_assoc_id, TRUE);
+			break;
+		case SCTP_COMM_LOST:
+		case SCTP_SHUTDOWN_COMP:
+		case SCTP_CANT_STR_ASSOC:
+			drop_assoc(sac->sac_assoc_id);
+			break;
+		default:
+			break;
+	}
+}
+
+// Same as update_events for a connection, but for the shared socket: reads
+// stop for everybody while any association is above its high-water mark
+int update_shared_events() {
+	int events = 0;
+
+	if (!shared_paused) events |= EPOLLIN;
+	if (pending) events |= EPOLLOUT;
+	if (events == shared_events) return TRUE;
+
+	shared_events = events;
+	shared_stats.ctls++;
+	return mod_epoll(accept_epoll_fd, events, server_sock, NULL);
+}
+
+int send_to_assoc(assoc_t *a, uint8_t *buffer, size_t len, uint16_t stream) {
+	int ret;
+	struct sctp_sndrcvinfo sinfo;
+
+	memset(&sinfo, 0, sizeof(sinfo));
+	sinfo.sinfo_assoc_id = a->id;
+	sinfo.sinfo_stream = stream;
+	policy_sinfo(&send_policy, &sinfo);
+
+#ifdef RATE
+	if (shared_stats.io.tx == 0) shared_stats.tx_start_ts = shared_stats.now;
+#endif
+	ret = SCTP_WRITE_INFO(server_sock, buffer, len, &sinfo);
+	shared_stats.writes++;
+	trace_event(TR_ASSOC_WRITE, a->id, len, ret, stream);
+	if (ret > 0) {
+		count(&shared_stats.io.tx, ret);
+#ifdef RATE
+		shared_stats.tx_end_ts = shared_stats.now;
+#endif
+	}
+	return ret;
+}
+
+// Echoes the message back on the association and stream it came from,
+// taking over the buffer from the shared pool like handle_write does
+int echo_to_assoc(assoc_t *a, uint8_t *buffer, size_t len, uint16_t stream, size_t cap) {
+	int ret;
+	size_t w = 0;
+
+	if (outq_empty(&a->outq)) {
+		ret = send_to_assoc(a, buffer, len, stream);
+		if (ret < 0) {
+			if (errno != EAGAIN) {
+				TRACE_ERROR("An error occur red while writing to association %d\n", a->id);
+				goto put_return;
+			}
+		} else {
+			w = ret;
+		}
+	}
+	if (w == len) {
+		bufpool_put(&shared_pool, buffer, cap);
+		return TRUE;
+	}
+
+	if (outq_push_owned(&a->outq, buffer, len, cap, stream) == FALSE) {
+		TRACE_ERROR("Outbound queue of association %d overflowed\n", a->id);
+		goto put_return;
+	}
+	if (w) outq_consume(&a->outq, w);
+	shared_stats.queued++;
+
+	if (!a->pending) {
+		a->pending = TRUE;
+		a->pending_next = pending;
+		pending = a;
+	}
+	if (!shared_paused && outq_above_high_water(&a->outq)) {
+		trace_event(TR_SHARED_PAUSE, server_sock, 0, 0, 0);
+		shared_paused = TRUE;
+		shared_stats.paused++;
+	}
+	return update_shared_events();
+
+put_return:
+	bufpool_put(&shared_pool, buffer, cap);
+	return FALSE;
+}
+
+void flush_pending() {
+	int ret, congested = FALSE;
+	outq_msg_t *msg;
+	assoc_t *a, *next;
+
+	for (a = pending; a; a = next) {
+		next = a->pending_next;
+		while (!outq_empty(&a->outq)) {
+			msg = outq_peek(&a->outq);
+			ret = send_to_assoc(a, msg->buf + msg->off, msg->len - msg->off, msg->stream);
+			if (ret < 0) break;
+			outq_consume(&a->outq, ret);
+		}
+
+		if (outq_empty(&a->outq)) {
+			unlink_pending(a);
+		} else if (errno != EAGAIN) {
+			TRACE_ERROR("An error occur red while writing to association %d\n", a->id);
+			abort_assoc(a);
+		} else if (!outq_below_low_water(&a->outq)) {
+			congested = TRUE;
+		}
+	}
+
+	if (shared_paused && !congested) {
+		trace_event(TR_SHARED_RESUME, server_sock, 0, 0, 0);
+		shared_paused = FALSE;
+	}
+	update_shared_events();
+}
+
+// Moves the association onto its own one-to-one fd and hands it over to a
+// reactor. The kernel migrates anything it has queued for the association.
+int peel_assoc(assoc_t *a) {
+	int sockid, flags;
+
+	sockid = sctp_peeloff(server_sock, a->id);
+	if (sockid == -1) {
+		TRACE_ERROR("Unable to peel off association %d, error: %s\n", a->id, strerror(errno));
+		return FALSE;
+	}
+
+	// The peeled off socket inherits our event subscriptions, but the
+	// reactors only want the sinfo, not the notifications
+	if (subscribe_events(sockid, FALSE) == FALSE) goto failed_return;
+
+	flags = fcntl(sockid, F_GETFL, 0);
+	if (fcntl(sockid, F_SETFL, flags | O_NONBLOCK) == -1) {
+		TRACE_ERROR("Unable to set peeled off socket as nonblocking, error: %s\n", strerror(errno));
+		goto failed_return;
+	}
+	if (assign_conn(sockid) == FALSE) goto failed_return;
+
+	TRACE_INFO("Peeled off association %d to fd %d\n", a->id, sockid);
+	nb_peeled++;
+	drop_assoc(a->id);
+	return TRUE;
+
+failed_return:
+	close(sockid);
+	return FALSE;
+}
+
+// Counts the message against the association's rate and peels it off once
+// the rate over the last window goes above the threshold. Returns TRUE if
+// the association was peeled off.
+int account_assoc(assoc_t *a, nano_ts_t now) {
+	double rate;
+
+	a->window_msgs++;
+	if (a->window_start == 0) a->window_start = now;
+	if (now - a->window_start < PEEL_WINDOW_NANO) return FALSE;
+
+	rate = a->window_msgs / NANO_TO_SEC(now - a->window_start);
+	a->window_msgs = 0;
+	a->window_start = now;
+	TRACE_DEBUG("Association %d is at %0.1f messages per second\n", a->id, rate);
+
+	// Anything still queued or half read would have to move with it, wait
+	// for both to drain and try again in the next window
+	if (rate < peel_threshold || !outq_empty(&a->outq) || !reasm_idle(&a->reasm)) return FALSE;
+	return peel_assoc(a);
+}
+
+// Reads from the one-to-many socket into buffers of the shared pool that go
+// with their echo. The association is only known after the read, so
+// pieces of a larger message are copied into its buffer.
+void read_shared() {
+	int r, flags, ret;
+	uint8_t *buffer;
+	struct sctp_sndrcvinfo sinfo;
+	assoc_t *a;
+	reasm_msg_t *m;
+	nano_ts_t now = 0;
+
+	// One timestamp per wakeup is plenty for a one second window
+	if (model == MODEL_HYBRID) now = nano_ts();
+
+	for (int n = 0; n < read_budget && !shared_paused; n++) {
+#ifdef RATE
+		if (shared_stats.io.rx == 0) shared_stats.rx_start_ts = shared_stats.now;
+#endif
+		if (rx_buf == NULL) {
+			rx_buf = bufpool_get(&shared_pool, MAX_BUFF, &rx_cap);
+			if (rx_buf == NULL) {
+				TRACE_ERROR("The one-to-many socket is out of buffers\n");
+				return;
+			}
+		}
+		buffer = rx_buf;
+		flags = 0;
+		r = SCTP_READ_INFO(server_sock, buffer, MAX_BUFF, &sinfo, &flags);
+		shared_stats.reads++;
+		if (r < 0) {
+			if (errno != EAGAIN) {
+				TRACE_ERROR("An error occured while reading from the one-to-many socket, "
+							"error: %s\n", strerror(errno));
+			}
+			return;
+		}
+
+		if (flags & MSG_NOTIFICATION) {
+			handle_notification(buffer, r);
+			continue;
+		}
+
+		count(&shared_stats.io.rx, r);
+#ifdef RATE
+		shared_stats.rx_end_ts = shared_stats.now;
+#endif
+		trace_event(TR_ASSOC_READ, sinfo.sinfo_assoc_id, r, 0, sinfo.sinfo_stream);
+
+		a = find_assoc(sinfo.sinfo_assoc_id, TRUE);
+		if (a == NULL) continue;
+
+		// Same as for a connection, pieces are echoed once the whole
+		// message is there
+		if ((flags & MSG_EOR) && reasm_idle(&a->reasm)) {
+			rx_buf = NULL;
+			ret = echo_to_assoc(a, buffer, r, sinfo.sinfo_stream, rx_cap);
+		} else {
+			if (reasm_add(&a->reasm, sinfo.sinfo_stream, buffer, r, flags & MSG_EOR, &m) == FALSE) {
+				TRACE_ERROR("Unable to put a message of association %d together\n", a->id);
+				abort_assoc(a);
+				continue;
+			}
+			if (m == NULL) continue;
+			ret = echo_to_assoc(a, m->buf, m->len, m->stream, m->cap);
+			reasm_done(&a->reasm, m);
+		}
+		count(&shared_stats.io.msgs, 1);
+		if (ret == FALSE) {
+			abort_assoc(a);
+			continue;
+		}
+		if (model == MODEL_HYBRID) account_assoc(a, now);
+	}
+}
+
+void run_seqpacket() {
+	int nb_ev;
+	struct epoll_event ev[BURST_SIZE];
+
+	// The association events tell us when to release the per association
+	// state
+	if (subscribe_events(server_sock, TRUE) == FALSE) return;
+
+	if (model == MODEL_HYBRID) {
+		TRACE_INFO("Serving associations on the one-to-many socket, peeling off "
+					"the ones above %d messages per second\n", peel_threshold);
+	} else {
+		TRACE_INFO("Serving all associations on the one-to-many socket\n");
+	}
+	while (!force_quit) {
+		nb_ev = epoll_wait(accept_epoll_fd, ev, BURST_SIZE, -1);
+		shared_stats.waits++;
+		trace_poll();
+		if (nb_ev <= 0) continue;
+		shared_stats.wakeups++;
+#ifdef RATE
+		shared_stats.now = nano_ts();
+#endif
+
+		if (ev[0].events & EPOLLOUT) flush_pending();
+		if (ev[0].events & EPOLLIN) read_shared();
+	}
+
+	TRACE_INFO("Served up to %d associations at once, %d still up\n", peak_assocs, nb_assocs);
+	drop_all_assocs();
+	if (rx_buf) bufpool_put(&shared_pool, rx_buf, rx_cap);
+	bufpool_destroy(&shared_pool);
+}
@@ -1,280 +1,1196 @@
+#define _GNU_SOURCE
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
-#include <netinet/sctp.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 
 #include "debug.h"
-#include "common.h"
+#include "server.h"
+#include "affinity.h"
 
-#define EPOLL_SIZE (1024)
-#define BURST_SIZE (32)
-#define MAX_BUFF (1024)
-#define BACKLOG (100)
-#define PORT (8877)
+// Busy polling of the epoll set as well, only in the uapi headers of
+// Linux 6.9 and later
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+// Packets the epoll busy poll takes off the device queue at once
+#define BUSY_POLL_BUDGET (64)
 
 int server_sock = -1;
-int epoll_fd = -1;
+int accept_epoll_fd = -1;
 int force_quit = FALSE;
-#ifdef RATE
-micro_ts_t rx_start_ts, rx_end_ts;
-micro_ts_t tx_start_ts, tx_end_ts;
-size_t rx, tx;
-#endif
 
-int add_to_epoll(int events, int fd) {
-  int ret;
-  struct epoll_event ev;
+model_t model = MODEL_STREAM;
+int use_uring = FALSE;
+int peel_threshold = DEFAULT_PEEL_THRESHOLD;
+int nb_streams = DEFAULT_STREAMS;
+int interleave = FALSE;
+// Echoes go out right away instead of being bundled by the stack
+int nodelay = FALSE;
+int nb_reactors = DEFAULT_REACTORS;
+// Pending associations the listeners queue, 0 takes the tuning profile's
+// or BACKLOG
+int backlog = 0;
+int nb_acceptors = DEFAULT_ACCEPTORS;
+acceptor_t acceptors[MAX_ACCEPTORS];
+// Associations the main thread accepted
+size_t nb_accepted = 0;
+placement_t placement = PLACE_ROUND_ROBIN;
+int edge_triggered = FALSE;
+int read_budget = DEFAULT_READ_BUDGET;
+// Reactors spin on epoll this long after their last event before they
+// block, 0 always blocks
+nano_ts_t spin_budget = 0;
+// SO_BUSY_POLL of the associations and busy polling of the reactors'
+// epoll sets, in microseconds
+int busy_poll = 0;
+// CPUs the reactors are pinned to, in turn, empty leaves them to the
+// scheduler
+cpu_list_t reactor_cpus;
+int report_interval = DEFAULT_REPORT_INTERVAL;
+reactor_t reactors[MAX_REACTORS];
+reactor_stats_t shared_stats;
+bufpool_t shared_pool;
 
-  ev.events = events;
-  ev.data.fd = fd;
+int add_to_epoll(int epoll_fd, int events, int fd, void *ptr) {
+	int ret;
+	struct epoll_event ev;
 
-  TRACE_INFO("Adding fd %d to epoll\n", fd);
-  ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
-  if (ret == -1) {
-    TRACE_ERROR("Unable to add fd to epoll, epoll_ctl: %s\n", strerror(errno));
-	return FALSE;
-  }
-  return TRUE;
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	TRACE_DEBUG("Adding fd %d to epoll %d\n", fd, epoll_fd);
+	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	if (ret == -1) {
+		TRACE_ERROR("Unable to add fd to epoll, epoll_ctl: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
 }
 
-int rm_from_epoll(int fd) {
-  int ret;
-  struct epoll_event ev;
+int mod_epoll(int epoll_fd, int events, int fd, void *ptr) {
+	int ret;
+	struct epoll_event ev;
 
-  ret = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
-  if (ret == -1) {
-    TRACE_ERROR("Unable to remove fd from epoll, epoll_ctl: %s\n", strerror(errno));
-	return FALSE;
-  }
-  return TRUE;
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	ret = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+	if (ret == -1) {
+		TRACE_ERROR("Unable to modify fd in epoll, epoll_ctl: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
 }
 
-int setup_listener() {
-	int ret, flags;
+// Makes epoll_wait poll the device queues of the sockets in the set for up
+// to busy_poll microseconds when nothing is ready
+void set_epoll_busy_poll(int epoll_fd) {
+	struct epoll_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.busy_poll_usecs = busy_poll;
+	params.busy_poll_budget = BUSY_POLL_BUDGET;
+	if (ioctl(epoll_fd, EPIOCSPARAMS, &params) == -1) {
+		TRACE_ERROR("Unable to busy poll epoll %d, error: %s\n", epoll_fd, strerror(errno));
+	}
+}
+
+int rm_from_epoll(int epoll_fd, int fd) {
+	int ret;
+	struct epoll_event ev;
+
+	ret = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+	if (ret == -1) {
+		TRACE_ERROR("Unable to remove fd from epoll, epoll_ctl: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int subscribe_events(int sockid, int assoc_events) {
+	int ret;
+	struct sctp_event_subscribe events;
+
+	memset(&events, 0, sizeof(events));
+	events.sctp_data_io_event = 1;
+	events.sctp_association_event = assoc_events;
+	events.sctp_partial_delivery_event = 1;
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_EVENTS, &events, sizeof(events));
+	if (ret == -1) {
+		TRACE_ERROR("Unable to subscribe to SCTP events, error: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void handle_pd_event(reasm_t *r, union sctp_notification *sn) {
+	struct sctp_pdapi_event *pd = &sn->sn_pdapi_event;
+
+	if (sn->sn_header.sn_type != SCTP_PARTIAL_DELIVERY_EVENT) return;
+	TRACE_INFO("Partial delivery on stream %d was aborted\n", pd->pdapi_stream);
+	reasm_drop(r, pd->pdapi_stream);
+}
+
+int open_listener(int type) {
+	int sockid, ret, flags, one = 1;
 	struct sockaddr_in servaddr;
 	struct sctp_initmsg initmsg;
 
-	server_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
-	if (server_sock == -1) {
+	sockid = socket(AF_INET, type, IPPROTO_SCTP);
+	if (sockid == -1) {
 		TRACE_ERROR("Failed to create server socket\n");
 		goto sock_failed;
 	}
 
+	if (tune_apply(sockid, &tuning) == FALSE) goto failed_return;
+
+	// Every acceptor binds a listener of its own to the same port
+	if (nb_acceptors) {
+		ret = setsockopt(sockid, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+		if (ret == -1) {
+			TRACE_ERROR("Unable to set SO_REUSEPORT, error: %s\n", strerror(errno));
+			goto failed_return;
+		}
+	}
+
 	bzero((void *)&servaddr, sizeof(servaddr));
 	servaddr.sin_family = AF_INET;
 	servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
 	servaddr.sin_port = htons(PORT);
-	ret = bind(server_sock, (struct sockaddr *)&servaddr, sizeof(servaddr));
+	ret = bind(sockid, (struct sockaddr *)&servaddr, sizeof(servaddr));
 	if (ret == -1) {
 		TRACE_ERROR("Failed to bind the server socket\n");
 		goto failed_return;
 	}
 
-	/* Specify that a maximum of 5 streams will be available per socket */
+	/* Specify that a maximum of nb_streams streams will be available per socket */
 	memset(&initmsg, 0, sizeof(initmsg));
-	initmsg.sinit_num_ostreams = 5;
-	initmsg.sinit_max_instreams = 5;
+	initmsg.sinit_num_ostreams = nb_streams;
+	initmsg.sinit_max_instreams = nb_streams;
 	initmsg.sinit_max_attempts = 4;
-	ret = setsockopt(server_sock, IPPROTO_SCTP, SCTP_INITMSG, &initmsg, sizeof(initmsg));
+	ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_INITMSG, &initmsg, sizeof(initmsg));
 	if (ret == -1) {
 		TRACE_ERROR("Unable to set socket options on server socket\n");
 		goto failed_return;
 	}
 
-	flags = fcntl(server_sock, F_GETFL, 0);
-	ret = fcntl(server_sock, F_SETFL, flags | O_NONBLOCK);
+	// Every echo goes out on the stream its message came in on, which
+	// only the sndrcvinfo tells. Accepted sockets inherit this.
+	if (subscribe_events(sockid, FALSE) == FALSE) goto failed_return;
+	if (policy_partial(&send_policy) && enable_partial(sockid) == FALSE) goto failed_return;
+	if (interleave && enable_interleaving(sockid, MAX_BUFF) == FALSE) goto failed_return;
+	// Accepted and peeled off sockets inherit it
+	if (nodelay && set_nodelay(sockid) == FALSE) goto failed_return;
+	// Inherited as well. Without the privilege the reactors still spin,
+	// they just don't poll the device.
+	if (busy_poll) set_busy_poll(sockid, busy_poll);
+
+	flags = fcntl(sockid, F_GETFL, 0);
+	ret = fcntl(sockid, F_SETFL, flags | O_NONBLOCK);
 	if (ret == -1) {
 		TRACE_ERROR("Unable to set server socket as nonblocking, error: %s\n", strerror(errno));
 		goto failed_return;
 	}
 
-	ret = listen(server_sock, BACKLOG);
+	ret = listen(sockid, backlog);
 	if (ret == -1) {
 		TRACE_ERROR("Unable to listen on the server socket\n");
 		goto failed_return;
 	}
-	TRACE_INFO("Returing from setup_listener\n");
-	return TRUE;
+	TRACE_INFO("Returing from open_listener\n");
+	return sockid;
 
 failed_return:
-	close(server_sock);
+	close(sockid);
 sock_failed:
+	return -1;
+}
+
+// Called by every acceptor
+reactor_t *pick_reactor() {
+	static unsigned int next = 0;
+	reactor_t *r;
+
+	if (placement == PLACE_ROUND_ROBIN)
+		return &reactors[__atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % nb_reactors];
+
+	r = &reactors[0];
+	for (int i = 1; i < nb_reactors; i++) {
+		if (__atomic_load_n(&reactors[i].nb_conns, __ATOMIC_RELAXED) <
+				__atomic_load_n(&r->nb_conns, __ATOMIC_RELAXED))
+			r = &reactors[i];
+	}
+	return r;
+}
+
+void link_conn(reactor_t *r, conn_t *conn) {
+	pthread_mutex_lock(&r->lock);
+	conn->prev = NULL;
+	conn->next = r->conns;
+	if (r->conns) r->conns->prev = conn;
+	r->conns = conn;
+	__atomic_add_fetch(&r->nb_conns, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&r->lock);
+}
+
+void unlink_conn(reactor_t *r, conn_t *conn) {
+	pthread_mutex_lock(&r->lock);
+	if (conn->prev) conn->prev->next = conn->next;
+	else r->conns = conn->next;
+	if (conn->next) conn->next->prev = conn->prev;
+	__atomic_sub_fetch(&r->nb_conns, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&r->lock);
+}
+
+void mark_ready(conn_t *conn) {
+	reactor_t *r = conn->reactor;
+
+	if (conn->on_ready) return;
+	conn->on_ready = TRUE;
+	conn->ready_next = r->ready;
+	r->ready = conn;
+}
+
+void unmark_ready(conn_t *conn) {
+	conn_t **p = &conn->reactor->ready;
+
+	if (!conn->on_ready) return;
+	while (*p != conn) p = &(*p)->ready_next;
+	*p = conn->ready_next;
+	conn->on_ready = FALSE;
+}
+
+void close_conn(conn_t *conn) {
+	reactor_t *r = conn->reactor;
+
+	trace_event(TR_CLOSE, conn->sockid, 0, r->id, 0);
+	unmark_ready(conn);
+	rm_from_epoll(r->epoll_fd, conn->sockid);
+	// One-to-one associations stay around until the socket is closed, even
+	// after the client shut them down
+	if (policy_partial(&send_policy)) get_abandoned(conn->sockid, 0, &r->stats.abandoned);
+	close(conn->sockid);
+	unlink_conn(r, conn);
+	outq_clear(&conn->outq);
+	reasm_clear(&conn->reasm);
+	// The workers still have messages of it, the last one frees it
+	if (conn->inflight) {
+		conn->closed = TRUE;
+		return;
+	}
+	free(conn);
+}
+
+// Hands a connected socket over to one of the reactors. The reactor may
+// start reading as soon as the fd is in its epoll, so it has to be
+// nonblocking already.
+int assign_conn(int sockid) {
+	reactor_t *r;
+	conn_t *conn;
+
+	if (set_sched(sockid, 0, &stream_sched) == FALSE) goto return_failed;
+
+	conn = calloc(1, sizeof(conn_t));
+	if (conn == NULL) {
+		TRACE_ERROR("Unable to allocate connection state\n");
+		goto return_failed;
+	}
+
+	r = pick_reactor();
+	conn->sockid = sockid;
+	conn->reactor = r;
+	conn->reasm.pool = &r->pool;
+	conn->outq.pool = &r->pool;
+	conn->events = EPOLLIN | (edge_triggered ? EPOLLET : 0);
+	if (nb_workers) conn->worker = pipeline_pick();
+	link_conn(r, conn);
+
+	if (add_to_epoll(r->epoll_fd, conn->events, sockid, conn) == FALSE) goto epoll_failed;
+
+	TRACE_DEBUG("Added the new connection to reactor %d\n", r->id);
+	return TRUE;
+
+epoll_failed:
+	unlink_conn(r, conn);
+	free(conn);
+return_failed:
 	return FALSE;
 }
 
-int accept_conn() {
-	int sockid, flags, ret;
+// The socket comes out of accept4 nonblocking, no fcntl round trips per
+// association
+int accept_conn(int listen_fd) {
+	int sockid;
 
 	TRACE_DEBUG("Waiting to accept a new client\n");
-	sockid = accept(server_sock, NULL, NULL);
+	sockid = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
 	if (sockid == -1) {
 		if (errno != EAGAIN) {
-			TRACE_ERROR("Could not accept new connection!\n");
+			TRACE_ERROR("Could not accept new connection, error: %s\n", strerror(errno));
 		}
-		goto return_failed;
+		return FALSE;
 	}
-	TRACE_DEBUG("Accepted a new client\n");
+	trace_event(TR_ACCEPT, sockid, 0, 0, 0);
 
-	if (add_to_epoll(EPOLLIN, sockid) == FALSE) goto epoll_failed;
+	if (assign_conn(sockid) == FALSE) {
+		close(sockid);
+		return FALSE;
+	}
+	return TRUE;
+}
 
-	flags = fcntl(sockid, F_GETFL, 0);
-	ret = fcntl(sockid, F_SETFL, flags | O_NONBLOCK);
-	if (ret == -1) {
-		TRACE_ERROR("Unable to set server socket as nonblocking, error: %s\n", strerror(errno));
-		goto failed_nonblocking;
+void* run_acceptor(void *arg) {
+	acceptor_t *a = (acceptor_t *)arg;
+	struct epoll_event ev[BURST_SIZE];
+	int nb_ev;
+
+	trace_thread("acceptor", a->id);
+	while (!force_quit) {
+		nb_ev = epoll_wait(a->epoll_fd, ev, BURST_SIZE, -1);
+		if (nb_ev <= 0) continue;
+
+		// A storm of handshakes queues many at once, take them all
+		while (accept_conn(a->listen_fd)) a->accepted++;
 	}
+	return NULL;
+}
 
-	TRACE_INFO("Added the new connection to epoll\n");
+int init_acceptor(acceptor_t *a, int id) {
+	a->id = id;
+	a->accepted = 0;
+	a->listen_fd = open_listener(SOCK_STREAM);
+	if (a->listen_fd == -1) goto listener_failed;
+
+	a->epoll_fd = epoll_create(EPOLL_SIZE);
+	if (a->epoll_fd == -1) {
+		TRACE_ERROR("Unable to create epoll, epoll: %s\n", strerror(errno));
+		goto epoll_failed;
+	}
+	a->wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (a->wake_fd == -1) {
+		TRACE_ERROR("Unable to create eventfd, eventfd: %s\n", strerror(errno));
+		goto eventfd_failed;
+	}
+	if (add_to_epoll(a->epoll_fd, EPOLLIN, a->listen_fd, NULL) == FALSE) goto add_failed;
+	if (add_to_epoll(a->epoll_fd, EPOLLIN, a->wake_fd, NULL) == FALSE) goto add_failed;
 	return TRUE;
 
-failed_nonblocking:
+add_failed:
+	close(a->wake_fd);
+eventfd_failed:
+	close(a->epoll_fd);
 epoll_failed:
-	close(sockid);
-return_failed:
+	close(a->listen_fd);
+listener_failed:
 	return FALSE;
 }
 
-int handle_write(int sockid, uint8_t *buffer, size_t len) {
-	int ret, w = 0;
-	while (w < len) {
+// Wakes every acceptor up, waits for it and closes its listener
+void stop_acceptors(int nb) {
+	uint64_t one = 1;
+
+	for (int i = 0; i < nb; i++) {
+		if (write(acceptors[i].wake_fd, &one, sizeof(one)) == -1)
+			TRACE_ERROR("Unable to wake acceptor %d, error: %s\n", i, strerror(errno));
+	}
+	for (int i = 0; i < nb; i++) {
+		pthread_join(acceptors[i].thread, NULL);
+		close(acceptors[i].wake_fd);
+		close(acceptors[i].epoll_fd);
+		close(acceptors[i].listen_fd);
+	}
+}
+
+// Keeps the epoll registration in line with the connection state: read
+// unless the outbound queue is above its high-water mark, and wait for
+// EPOLLOUT as long as there is something queued
+int update_events(conn_t *conn) {
+	int events = edge_triggered ? EPOLLET : 0;
+
+	if (!conn->read_paused) events |= EPOLLIN;
+	if (!outq_empty(&conn->outq)) events |= EPOLLOUT;
+	if (events == conn->events) return TRUE;
+
+	trace_event(TR_EVENTS, conn->sockid, conn->events, events, 0);
+	conn->events = events;
+	conn->reactor->stats.ctls++;
+	return mod_epoll(conn->reactor->epoll_fd, events, conn->sockid, conn);
+}
+
+// Echoes the message in buffer, a buffer of cap bytes from the reactor's
+// pool that is ours from now on. It is queued as is if it can't be written
+// right away, and given back once it has been.
+int handle_write(conn_t *conn, uint8_t *buffer, size_t len, uint16_t stream, size_t cap) {
+	int ret;
+	size_t w = 0;
+	reactor_t *r = conn->reactor;
+	reactor_stats_t *stats = &r->stats;
+
+	// Anything already queued has to go out first to keep the ordering
+	if (outq_empty(&conn->outq)) {
 #ifdef RATE
-		if (tx == 0) tx_start_ts = micro_ts();
+		if (stats->io.tx == 0) stats->tx_start_ts = stats->now;
 #endif
-		ret = SCTP_WRITE(sockid, buffer + w, len - w);
-		TRACE_DEBUG("Tried to send %ld bytes, sent %d\n", len - w, ret);
+		ret = SCTP_WRITE_STREAM(conn->sockid, buffer, len, stream, &send_policy);
+		stats->writes++;
+		trace_event(TR_WRITE, conn->sockid, len, ret, stream);
 		if (ret < 0) {
 			if (errno != EAGAIN) {
-				TRACE_ERROR("An error occur red while writing to server\n");
+				TRACE_ERROR("An error occur red while writing to client\n");
+				goto put_return;
+			}
+		} else {
+			w = ret;
+			count(&stats->io.tx, ret);
+#ifdef RATE
+			stats->tx_end_ts = stats->now;
+#endif
+		}
+	}
+	if (w == len) {
+		bufpool_put(&r->pool, buffer, cap);
+		return TRUE;
+	}
+
+	if (outq_push_owned(&conn->outq, buffer, len, cap, stream) == FALSE) {
+		TRACE_ERROR("Outbound queue of connection %d overflowed\n", conn->sockid);
+		goto put_return;
+	}
+	// Only possible with an empty queue, so it is the head
+	if (w) outq_consume(&conn->outq, w);
+	stats->queued++;
+	trace_event(TR_QUEUE, conn->sockid, len - w, conn->outq.bytes, stream);
+
+	if (!conn->read_paused && outq_above_high_water(&conn->outq)) {
+		trace_event(TR_PAUSE, conn->sockid, 0, 0, 0);
+		conn->read_paused = TRUE;
+		stats->paused++;
+	}
+	return update_events(conn);
+
+put_return:
+	bufpool_put(&r->pool, buffer, cap);
+	return FALSE;
+}
+
+int flush_outq(conn_t *conn) {
+	int ret;
+	outq_msg_t *msg;
+	reactor_stats_t *stats = &conn->reactor->stats;
+
+	while (!outq_empty(&conn->outq)) {
+		msg = outq_peek(&conn->outq);
+		ret = SCTP_WRITE_STREAM(conn->sockid, msg->buf + msg->off, msg->len - msg->off,
+								msg->stream, &send_policy);
+		stats->writes++;
+		trace_event(TR_FLUSH, conn->sockid, msg->len - msg->off, ret, msg->stream);
+		if (ret < 0) {
+			if (errno == EAGAIN) break;
+			TRACE_ERROR("An error occur red while writing to client\n");
+			return FALSE;
+		}
+		count(&stats->io.tx, ret);
+#ifdef RATE
+		stats->tx_end_ts = stats->now;
+#endif
+		outq_consume(&conn->outq, ret);
+	}
+
+	if (conn->read_paused && outq_below_low_water(&conn->outq)) {
+		trace_event(TR_RESUME, conn->sockid, 0, 0, 0);
+		conn->read_paused = FALSE;
+	}
+	return update_events(conn);
+}
+
+// Echoes the message, through the connection's worker in pipeline mode
+static inline int echo_msg(conn_t *conn, uint8_t *buffer, size_t len, uint16_t stream, size_t cap) {
+	if (nb_workers) return pipeline_push(conn->reactor, conn, buffer, len, stream, cap);
+	return handle_write(conn, buffer, len, stream, cap);
+}
+
+// Reads and echoes messages from the connection. A message that doesn't
+// fit in one read, or is partially delivered, is echoed once all of it is
+// there. Messages are read into buffers of the reactor's pool that go
+// with their echo, and while a single message is in progress the reads go
+// straight into its buffer, so nothing is copied or allocated on the way.
+// Level-triggered mode does a single read per wakeup. Edge-triggered mode
+// keeps reading until the socket is drained, but at most read_budget
+// messages so one busy connection cannot starve the others. A connection
+// that uses up its budget is put on the reactor's ready list, because no
+// new edge will be reported for the data it still has. The one-to-many
+// socket is level-triggered but takes read_budget messages per wakeup as
+// well, see read_shared.
+int read_event(conn_t *conn) {
+	int r, budget, flags, ret;
+	uint8_t *dst;
+	size_t room;
+	struct sctp_sndrcvinfo sinfo;
+	reasm_msg_t *m;
+	reactor_t *reactor = conn->reactor;
+	reactor_stats_t *stats = &reactor->stats;
+
+	budget = edge_triggered ? read_budget : 1;
+	for (int n = 0; n < budget; n++) {
+		if (conn->read_paused) return TRUE;
+#ifdef RATE
+		if (stats->io.rx == 0) stats->rx_start_ts = stats->now;
+#endif
+		flags = 0;
+		dst = reasm_tail(&conn->reasm, &room);
+		if (dst == NULL) {
+			if (reactor->rx_buf == NULL) {
+				reactor->rx_buf = bufpool_get(&reactor->pool, MAX_BUFF, &reactor->rx_cap);
+				if (reactor->rx_buf == NULL) {
+					TRACE_ERROR("Reactor %d is out of buffers\n", reactor->id);
+					return FALSE;
+				}
+			}
+			dst = reactor->rx_buf;
+			room = MAX_BUFF;
+		}
+		r = SCTP_READ_INFO(conn->sockid, dst, room, &sinfo, &flags);
+		stats->reads++;
+		if (r <= 0) {
+			if (r == 0) {
+				TRACE_DEBUG("The connection closed from the client side\n");
+				return FALSE;
+			} else if (errno != EAGAIN) {
+				TRACE_ERROR("An error occured while reading from server\n");
 				return FALSE;
 			}
-			if (force_quit) return FALSE;
+			return TRUE;
+		}
+		if (flags & MSG_NOTIFICATION) {
+			handle_pd_event(&conn->reasm, (union sctp_notification *)dst);
 			continue;
 		}
-		if (force_quit) return FALSE;
-
-		w += ret;
+		count(&stats->io.rx, r);
 #ifdef RATE
-		tx += ret;
-		tx_end_ts = micro_ts();
+		stats->rx_end_ts = stats->now;
 #endif
+
+		trace_event(TR_READ, conn->sockid, r, 0, sinfo.sinfo_stream);
+		if ((flags & MSG_EOR) && reasm_idle(&conn->reasm)) {
+			// The buffer goes with the echo, the next read takes another
+			dst = reactor->rx_buf;
+			reactor->rx_buf = NULL;
+			count(&stats->io.msgs, 1);
+			if (echo_msg(conn, dst, r, sinfo.sinfo_stream, reactor->rx_cap) == FALSE)
+				return FALSE;
+			continue;
+		}
+
+		if (reasm_add(&conn->reasm, sinfo.sinfo_stream, dst, r, flags & MSG_EOR, &m) == FALSE) {
+			TRACE_ERROR("Unable to put a message of connection %d together\n", conn->sockid);
+			return FALSE;
+		}
+		if (m == NULL) continue;
+		count(&stats->io.msgs, 1);
+		ret = echo_msg(conn, m->buf, m->len, m->stream, m->cap);
+		reasm_done(&conn->reasm, m);
+		if (ret == FALSE) return FALSE;
 	}
+
+	if (edge_triggered) mark_ready(conn);
 	return TRUE;
 }
 
-int read_event(int sockid) {
-	int r;
-	uint8_t buffer[MAX_BUFF];
+// Gives every connection that ran out of read budget another turn
+void process_ready(reactor_t *r) {
+	conn_t *conn, *next;
+
+	conn = r->ready;
+	r->ready = NULL;
+	for (; conn; conn = next) {
+		next = conn->ready_next;
+		conn->on_ready = FALSE;
+		if (read_event(conn) == FALSE) close_conn(conn);
+	}
+}
 
+// Waits for the next events. With a spin budget the reactor polls epoll
+// without blocking until the budget since it went idle is used up, and
+// only then goes to sleep, so a message that arrives in the meantime
+// doesn't pay for the wakeup.
+int reactor_wait(reactor_t *r, struct epoll_event *ev) {
+	int nb_ev;
+	nano_ts_t deadline;
+
+	// Don't block while connections still have unread messages
+	if (r->ready) return epoll_wait(r->epoll_fd, ev, BURST_SIZE, 0);
+
+	if (spin_budget) {
+		deadline = nano_ts() + spin_budget;
+		do {
+			nb_ev = epoll_wait(r->epoll_fd, ev, BURST_SIZE, 0);
+			if (nb_ev != 0) {
+				if (nb_ev > 0) r->stats.spin_wakeups++;
+				return nb_ev;
+			}
+			r->stats.spins++;
+			if (nb_workers && pipeline_pending(r)) return 0;
+		} while (!force_quit && nano_ts() < deadline);
+	}
+
+	// The workers only wake us up for their replies if we sleep, and we
+	// only sleep once we have seen there are none
+	__atomic_store_n(&r->sleeping, TRUE, __ATOMIC_SEQ_CST);
+	if (nb_workers && pipeline_pending(r)) {
+		nb_ev = 0;
+	} else {
+		r->stats.sleeps++;
+		nb_ev = epoll_wait(r->epoll_fd, ev, BURST_SIZE, -1);
+	}
+	__atomic_store_n(&r->sleeping, FALSE, __ATOMIC_RELAXED);
+	return nb_ev;
+}
+
+void* run_reactor(void *arg) {
+	int nb_ev;
+	conn_t *conn;
+	reactor_t *r = (reactor_t *)arg;
+	uint64_t wakes;
+	struct epoll_event ev[BURST_SIZE];
+	char placement[320];
+
+	pin_thread(&reactor_cpus, r->id);
+	describe_placement(placement, sizeof(placement));
+	TRACE_INFO("Reactor %d is running on %s\n", r->id, placement);
+	trace_thread("reactor", r->id);
+	while (!force_quit) {
+		trace_event(TR_WAIT, -1, 0, r->id, 0);
+		nb_ev = reactor_wait(r, ev);
+		trace_event(TR_WAKEUP, -1, nb_ev, r->id, 0);
+		r->stats.waits++;
+		if (nb_ev > 0) r->stats.wakeups++;
 #ifdef RATE
-	if (rx == 0) rx_start_ts = micro_ts();
+		r->stats.now = nano_ts();
 #endif
-	r = SCTP_READ(sockid, buffer, MAX_BUFF);
-	if (r <= 0) {
-		if (r == 0) {
-			TRACE_ERROR("The connection closed from the client side, exiting\n");
-			return FALSE;
-		} else if (errno != EAGAIN) {
-			TRACE_ERROR("An error occured while reading from server\n");
-			return FALSE;
+
+		for (int i = 0; i < nb_ev; i++) {
+			conn = (conn_t *)ev[i].data.ptr;
+			// Only the wake eventfd is registered without a connection
+			if (conn == NULL) {
+				if (read(r->wake_fd, &wakes, sizeof(wakes)) == -1 && errno != EAGAIN)
+					TRACE_ERROR("Reactor %d is unable to read its eventfd\n", r->id);
+				continue;
+			}
+
+			trace_event(TR_EVENT, conn->sockid, 0, i, 0);
+			if (ev[i].events & EPOLLERR) {
+				TRACE_INFO("Error occured on connection %d, closing the connection.\n", conn->sockid);
+				close_conn(conn);
+				continue;
+			}
+
+			if (ev[i].events & EPOLLOUT) {
+				if (flush_outq(conn) == FALSE) {
+					close_conn(conn);
+					continue;
+				}
+			}
+
+			if ((ev[i].events & EPOLLIN) && !conn->read_paused) {
+				// The ready list would read it again in this iteration
+				unmark_ready(conn);
+				if (read_event(conn) == FALSE) close_conn(conn);
+			}
 		}
-		return TRUE;
+
+		process_ready(r);
+		if (nb_workers) pipeline_collect(r);
 	}
+
+	while (r->conns) close_conn(r->conns);
+	if (r->rx_buf) bufpool_put(&r->pool, r->rx_buf, r->rx_cap);
+	bufpool_destroy(&r->pool);
+	return NULL;
+}
+
+int init_reactor(reactor_t *r, int id) {
+	memset(r, 0, sizeof(reactor_t));
+	r->id = id;
+	pthread_mutex_init(&r->lock, NULL);
+
+	r->epoll_fd = epoll_create(EPOLL_SIZE);
+	if (r->epoll_fd == -1) {
+		TRACE_ERROR("Unable to create epoll, epoll: %s\n", strerror(errno));
+		goto epoll_failed;
+	}
+
+	r->wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (r->wake_fd == -1) {
+		TRACE_ERROR("Unable to create eventfd, eventfd: %s\n", strerror(errno));
+		goto eventfd_failed;
+	}
+	if (add_to_epoll(r->epoll_fd, EPOLLIN, r->wake_fd, NULL) == FALSE) goto wake_failed;
+	if (busy_poll) set_epoll_busy_poll(r->epoll_fd);
+	return TRUE;
+
+wake_failed:
+	close(r->wake_fd);
+eventfd_failed:
+	close(r->epoll_fd);
+epoll_failed:
+	return FALSE;
+}
+
+void wake_reactor(reactor_t *r) {
+	uint64_t one = 1;
+	if (write(r->wake_fd, &one, sizeof(one)) == -1)
+		TRACE_ERROR("Unable to wake reactor %d, error: %s\n", r->id, strerror(errno));
+}
+
+typedef struct stats_summary {
+	size_t rx, tx, msgs, wakeups, syscalls;
+	size_t spins, spin_wakeups, sleeps;
+	abandoned_t abandoned;
+	double rx_rate, tx_rate, msg_rate;
+} stats_summary_t;
+
+void print_reactor_stats(char *name, reactor_stats_t *s, stats_summary_t *sum) {
+	sum->rx += s->io.rx;
+	sum->tx += s->io.tx;
+	sum->msgs += s->io.msgs;
+	sum->wakeups += s->wakeups;
+	sum->syscalls += s->waits + s->spins + s->reads + s->writes + s->ctls;
+	sum->spins += s->spins;
+	sum->spin_wakeups += s->spin_wakeups;
+	sum->sleeps += s->sleeps;
+	sum->abandoned.unsent += s->abandoned.unsent;
+	sum->abandoned.sent += s->abandoned.sent;
 #ifdef RATE
-	rx += r;
-	rx_end_ts = micro_ts();
+	double rx_elapsed = NANO_TO_SEC(s->rx_end_ts - s->rx_start_ts);
+	double tx_elapsed = NANO_TO_SEC(s->tx_end_ts - s->tx_start_ts);
+	double rx_rate = rx_elapsed > 0 ? BYTES_TO_BITS(BYTES_TO_GB(s->io.rx)) / rx_elapsed : 0;
+	double tx_rate = tx_elapsed > 0 ? BYTES_TO_BITS(BYTES_TO_GB(s->io.tx)) / tx_elapsed : 0;
+	double msg_rate = rx_elapsed > 0 ? s->io.msgs / rx_elapsed : 0;
+
+	TRACE_INFO("%s: received %ld bytes and sent %ld bytes, "
+				"RX rate: %0.4fGbps | TX rate: %0.4fGbps\n",
+				name, s->io.rx, s->io.tx, rx_rate, tx_rate);
+	sum->rx_rate += rx_rate;
+	sum->tx_rate += tx_rate;
+	sum->msg_rate += msg_rate;
 #endif
+	TRACE_INFO("%s: %ld messages waited for EPOLLOUT, reads paused %ld times\n",
+				name, s->queued, s->paused);
+	TRACE_INFO("%s: %ld messages, %ld wakeups, %ld waits, %ld reads, "
+				"%ld writes, %ld epoll_ctl\n",
+				name, s->io.msgs, s->wakeups, s->waits, s->reads, s->writes, s->ctls);
+	if (spin_budget)
+		TRACE_INFO("%s: %ld wakeups caught spinning, %ld empty spins, %ld sleeps\n",
+					name, s->spin_wakeups, s->spins, s->sleeps);
+	if (policy_partial(&send_policy))
+		TRACE_INFO("%s: %ld echoes abandoned before they were sent, %ld after\n",
+					name, s->abandoned.unsent, s->abandoned.sent);
+}
+
+void print_accepted() {
+	size_t accepted = nb_accepted;
+
+	for (int i = 0; i < nb_acceptors; i++) {
+		TRACE_INFO("Acceptor %d: %ld associations\n", i, acceptors[i].accepted);
+		accepted += acceptors[i].accepted;
+	}
+	TRACE_INFO("Accepted %ld associations | Acceptors: %d | Backlog: %d\n",
+				accepted, nb_acceptors, backlog);
+}
+
+void print_stats() {
+	char name[32], policy[64], profile[256];
+	stats_summary_t sum;
+	bufpool_t pools;
+	struct rusage usage;
+
+	memset(&sum, 0, sizeof(sum));
+	memset(&pools, 0, sizeof(pools));
+	bufpool_sum(&pools, &shared_pool);
+	if (use_uring) print_reactor_stats("io_uring", &shared_stats, &sum);
+	if (model != MODEL_STREAM) print_reactor_stats("One-to-many socket", &shared_stats, &sum);
+	if (model == MODEL_HYBRID) TRACE_INFO("Peeled off %ld hot associations\n", nb_peeled);
+	for (int i = 0; i < nb_reactors; i++) {
+		snprintf(name, sizeof(name), "Reactor %d", i);
+		print_reactor_stats(name, &reactors[i].stats, &sum);
+		bufpool_sum(&pools, &reactors[i].pool);
+	}
 
-	TRACE_DEBUG("Received %d bytes from client\n", r);
-	return handle_write(sockid, buffer, r);
+	TRACE_INFO("In summary (%s, %d reactors, %s):\n",
+				model == MODEL_STREAM ? "one-to-one" :
+				model == MODEL_SEQPACKET ? "one-to-many" : "hybrid",
+				nb_reactors, use_uring ? "io_uring" :
+				edge_triggered ? "edge-triggered" : "level-triggered");
+	TRACE_INFO("Received %ld bytes and sent %ld bytes\n", sum.rx, sum.tx);
+	policy_name(&send_policy, policy, sizeof(policy));
+	TRACE_INFO("Echoes sent %s | Stream scheduler: %s | Interleaving: %s | Nodelay: %s\n",
+				policy, sched_name(stream_sched.sched), interleave ? "on" : "off",
+				nodelay ? "on" : "off");
+	tune_describe(&tuning, profile, sizeof(profile));
+	TRACE_INFO("Tuning profile: %s\n", profile);
+	if (policy_partial(&send_policy)) {
+		TRACE_INFO("Abandoned echoes: %ld unsent | %ld sent\n",
+					sum.abandoned.unsent, sum.abandoned.sent);
+	}
+	// ru_maxrss is in KiB
+	if (getrusage(RUSAGE_SELF, &usage) == -1) memset(&usage, 0, sizeof(usage));
+	bufpool_print("Buffer pools", &pools);
+	TRACE_INFO("Peak RSS: %0.2fMiB\n", (double)usage.ru_maxrss / 1024);
+	if (spin_budget || busy_poll) {
+		TRACE_INFO("Busy polling: %0.1fus spin budget | SO_BUSY_POLL: %dus | "
+					"Caught spinning: %0.2f%% of wakeups | Sleeps per message: %0.4f\n",
+					NANO_TO_MICRO((double)spin_budget), busy_poll,
+					sum.wakeups ? 100.0 * sum.spin_wakeups / sum.wakeups : 0,
+					sum.msgs ? (double)sum.sleeps / sum.msgs : 0);
+	}
+	if (nb_workers) pipeline_print();
+	if (model == MODEL_STREAM && !use_uring) print_accepted();
+	TRACE_INFO("Wakeups per message: %0.4f | Syscalls per KiB: %0.4f\n",
+				sum.msgs ? (double)sum.wakeups / sum.msgs : 0,
+				sum.rx + sum.tx ? (double)sum.syscalls * 1024 / (sum.rx + sum.tx) : 0);
+#ifdef RATE
+	TRACE_INFO("RX rate: %0.4fGbps | TX rate: %0.4fGbps\n", sum.rx_rate, sum.tx_rate);
+	TRACE_INFO("Messages per second: %0.1f\n", sum.msg_rate);
+#endif
 }
 
 void handle_sigint(int sig)  {
 	printf("Caught signal %d, going to quit!\n", sig);
 	force_quit = TRUE;
-} 
-
-int main() {
-	int ret, fd, nb_ev, do_accept;
-  	struct epoll_event ev[BURST_SIZE];
+}
 
-	signal(SIGINT, handle_sigint);
+void usage(char *prog) {
+	fprintf(stderr,
+				"usage: %s \n"
+				"	-m Socket model, stream (one-to-one, default), seqpacket (one-to-many) or\n"
+				"	   hybrid (one-to-many, hot associations are peeled off to the reactors)\n"
+				"	-P Messages per second above which an association is peeled off in "
+				"hybrid mode, default is %d\n"
+				"	-s Inbound and outbound streams per association, default is %d and "
+				"maximum is %d\n"
+				"	-r Number of reactor threads for one-to-one or peeled off associations, "
+				"default is %d and maximum is %d\n"
+				"	-p Placement of new associations on reactors, "
+				"rr (round-robin, default) or ll (least-loaded)\n"
+				"	-a Threads accepting one-to-one associations, each on a SO_REUSEPORT\n"
+				"	   listener of its own, default is %d (the main thread) and maximum is %d\n"
+				"	-L Backlog of the listeners, default is the tuning profile's or %d, the\n"
+				"	   kernel caps it at net.core.somaxconn\n"
+				"	-u Serve one-to-one associations with io_uring instead of epoll\n"
+				"	-e Register connections edge-triggered and drain them on every wakeup\n"
+				"	-b Messages read from a connection per wakeup in edge-triggered mode, and\n"
+				"	   from the one-to-many socket in every mode, default is %d\n"
+				"	-B <us>[:<us>] Reactors spin on epoll for that many microseconds after their\n"
+				"	   last event before they block. The second value sets SO_BUSY_POLL and\n"
+				"	   the epoll busy poll time, above net.core.busy_read it needs CAP_NET_ADMIN\n"
+				"	-o Echo unordered\n"
+				"	-x Echo partially reliable, ttl:<ms> gives up on an echo that is not\n"
+				"	   delivered within that time, rtx:<n> after n retransmissions\n"
+				"	-S Stream scheduler of every association, fcfs, prio, rr, fc or wfq, followed\n"
+				"	   by :<value>,<value>... to give streams 0, 1, ... a priority (prio) or\n"
+				"	   weight (wfq), default is the kernel's\n"
+				"	-I Interleave large messages with the others (I-DATA), delivering them in\n"
+				"	   pieces, needs net.sctp.intl_enable\n"
+				"	-W Pipeline mode with that many workers, the reactors hand every message\n"
+				"	   to a worker and echo what it returns, default is %d and maximum is %d\n"
+				"	-c Nanoseconds of work per message in the workers, default is 0\n"
+				"	-A CPUs to pin the workers to in turn, like 4-7, default is none\n"
+				"	-C CPUs to pin the reactors to in turn, like 0-3,8, default is none\n"
+				"	-M Take the buffers of every reactor from its own NUMA node\n"
+				"	-D Network interface to check the placement against, prints its node and\n"
+				"	   the CPUs of its interrupts and RPS, and which reactor CPUs share them\n"
+				"	-N Set SCTP_NODELAY, echoes are not bundled into packets by the stack\n"
+				"	-H Back the message buffers with huge pages\n"
+				"	-F Config file with tuning profiles, see tune.conf\n"
+				"	-K Tuning profile of the listening socket, default, low-latency, bulk or one\n"
+				"	   of the config file, default is default\n"
+				"	-i Seconds between live rate reports, 0 turns them off, default is %d\n"
+				"	-g Record the hot path events into this file, on exit and on SIGUSR1,\n"
+				"	   SIGUSR2 pauses and resumes the recording, see tracedump\n"
+				"	-T Measure the cost of every clock source and exit\n"
+				"	-h This help text\n",
+				prog, DEFAULT_PEEL_THRESHOLD, DEFAULT_STREAMS, MAX_STREAMS, DEFAULT_REACTORS, MAX_REACTORS,
+				DEFAULT_ACCEPTORS, MAX_ACCEPTORS, BACKLOG, DEFAULT_READ_BUDGET, DEFAULT_WORKERS, MAX_WORKERS, DEFAULT_REPORT_INTERVAL);
+	exit(EXIT_FAILURE);
+}
 
+int main(int argc, char *argv[]) {
+	int opt, nb_ev, started, streams_set = FALSE;
+	char *end, *tune_file = NULL, *profile = NULL, *trace_file = NULL, *ifname = NULL;
+	struct epoll_event ev[BURST_SIZE];
+	sigset_t sigset, oldset;
 #ifdef RATE
-	rx_start_ts = rx_end_ts = 0;
-	tx_start_ts = tx_end_ts = 0;
-	rx = tx = 0;
+	reporter_t reporter;
+	counters_t *counters[MAX_REACTORS + 1];
+	int nb_counters = 0, reporting = FALSE;
 #endif
 
-	ret = setup_listener();
-	if (ret == FALSE) goto listener_failed;
-	TRACE_INFO("Listening on the server socket!\n");
+	while ((opt = getopt(argc, argv, "m:P:s:r:p:a:L:ueb:B:ox:S:IW:c:A:C:MD:NHF:K:i:g:Th")) != -1) {
+		switch(opt) {
+			case 'm':
+				if (strcmp(optarg, "stream") == 0) model = MODEL_STREAM;
+				else if (strcmp(optarg, "seqpacket") == 0) model = MODEL_SEQPACKET;
+				else if (strcmp(optarg, "hybrid") == 0) model = MODEL_HYBRID;
+				else usage(argv[0]);
+				break;
+			case 'P':
+				peel_threshold = atoi(optarg);
+				if (peel_threshold < 1) usage(argv[0]);
+				break;
+			case 's':
+				nb_streams = atoi(optarg);
+				if (nb_streams < 1 || nb_streams > MAX_STREAMS) usage(argv[0]);
+				streams_set = TRUE;
+				break;
+			case 'r':
+				nb_reactors = atoi(optarg);
+				if (nb_reactors < 1 || nb_reactors > MAX_REACTORS) usage(argv[0]);
+				break;
+			case 'p':
+				if (strcmp(optarg, "rr") == 0) placement = PLACE_ROUND_ROBIN;
+				else if (strcmp(optarg, "ll") == 0) placement = PLACE_LEAST_LOADED;
+				else usage(argv[0]);
+				break;
+			case 'a':
+				nb_acceptors = atoi(optarg);
+				if (nb_acceptors < 0 || nb_acceptors > MAX_ACCEPTORS) usage(argv[0]);
+				break;
+			case 'L':
+				backlog = atoi(optarg);
+				if (backlog < 1) usage(argv[0]);
+				break;
+			case 'u':
+				use_uring = TRUE;
+				break;
+			case 'e':
+				edge_triggered = TRUE;
+				break;
+			case 'b':
+				read_budget = atoi(optarg);
+				if (read_budget < 1) usage(argv[0]);
+				break;
+			case 'B':
+				spin_budget = strtoul(optarg, &end, 10) * (NSEC_PER_SEC / 1000000);
+				if (*end == ':') busy_poll = strtol(end + 1, &end, 10);
+				if (*end != '\0' || busy_poll < 0) usage(argv[0]);
+				break;
+			case 'o':
+				send_policy.flags |= SCTP_UNORDERED;
+				break;
+			case 'x':
+				if (parse_policy(optarg, &send_policy) == FALSE) usage(argv[0]);
+				break;
+			case 'S':
+				if (parse_sched(optarg, &stream_sched) == FALSE) usage(argv[0]);
+				break;
+			case 'I':
+				interleave = TRUE;
+				break;
+			case 'W':
+				nb_workers = atoi(optarg);
+				if (nb_workers < 0 || nb_workers > MAX_WORKERS) usage(argv[0]);
+				break;
+			case 'c':
+				work_cost = strtoull(optarg, &end, 10);
+				if (*end != '\0') usage(argv[0]);
+				break;
+			case 'A':
+				if (parse_cpu_list(optarg, &worker_cpus) == FALSE) usage(argv[0]);
+				break;
+			case 'C':
+				if (parse_cpu_list(optarg, &reactor_cpus) == FALSE) usage(argv[0]);
+				break;
+			case 'M':
+				bufpool_local = TRUE;
+				break;
+			case 'D':
+				ifname = optarg;
+				break;
+			case 'N':
+				nodelay = TRUE;
+				break;
+			case 'H':
+				bufpool_hugepages = TRUE;
+				break;
+			case 'F':
+				tune_file = optarg;
+				break;
+			case 'K':
+				profile = optarg;
+				break;
+			case 'i':
+				report_interval = atoi(optarg);
+				if (report_interval < 0) usage(argv[0]);
+				break;
+			case 'g':
+				trace_file = optarg;
+				break;
+			case 'T':
+				timing_init();
+				timing_selftest();
+				exit(EXIT_SUCCESS);
+			case 'h':
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	// The ring only serves one-to-one associations
+	if (use_uring && model != MODEL_STREAM) usage(argv[0]);
+	// Only the reactors hand messages over
+	if (nb_workers && (use_uring || model == MODEL_SEQPACKET)) usage(argv[0]);
+	// The ring and the one-to-many socket accept on their own
+	if (nb_acceptors && (use_uring || model != MODEL_STREAM)) usage(argv[0]);
+
+	if (tune_file && tune_load(tune_file) == FALSE) exit(EXIT_FAILURE);
+	if (profile && tune_select(profile, &tuning) == FALSE) {
+		TRACE_ERROR("There is no tuning profile called %s\n", profile);
+		usage(argv[0]);
+	}
+	if (tuning.streams > 0 && !streams_set) nb_streams = MIN(tuning.streams, MAX_STREAMS);
+	if (backlog == 0) backlog = tuning.backlog > 0 ? tuning.backlog : BACKLOG;
+
+	timing_init();
+	signal(SIGINT, handle_sigint);
+	if (ifname) print_irq_hints(ifname, &reactor_cpus);
+	if (trace_file) {
+		trace_init(trace_file);
+		trace_thread("main", -1);
+	}
+
+	// The acceptors open their own listeners, one more in their
+	// SO_REUSEPORT group would get associations nobody accepts
+	if (nb_acceptors == 0) {
+		server_sock = open_listener(model == MODEL_STREAM ? SOCK_STREAM : SOCK_SEQPACKET);
+		if (server_sock == -1) goto listener_failed;
+		TRACE_INFO("Listening on the server socket!\n");
+	}
 
-  	epoll_fd = epoll_create(EPOLL_SIZE); 
-	if (epoll_fd == -1) {
+	accept_epoll_fd = epoll_create(EPOLL_SIZE);
+	if (accept_epoll_fd == -1) {
 		TRACE_ERROR("Unable to create epoll, epoll: %s\n", strerror(errno));
 		goto failed_exit;
 	}
-	add_to_epoll(EPOLLIN, server_sock);
+	if (server_sock != -1) add_to_epoll(accept_epoll_fd, EPOLLIN, server_sock, NULL);
 
-	do_accept = FALSE;
-  	while (!force_quit) {
-		TRACE_DEBUG("Wating for futher events...\n");
-		nb_ev = epoll_wait(epoll_fd, ev, BURST_SIZE, -1);
-		TRACE_DEBUG("Got %d events from epoll_wait\n", nb_ev);
+	// All the associations share the listening socket, nothing to hand
+	// over to reactors. In hybrid mode they only serve the peeled off ones.
+	if (model == MODEL_SEQPACKET) nb_reactors = 0;
 
-		for (int i = 0; i < nb_ev; i++) {
-			fd = ev[i].data.fd;
-			TRACE_DEBUG("Processign %d event, Got an event againt fd: %d\n", i, fd);
-			if (fd == server_sock)  {
-				do_accept = TRUE;
-				continue;
-			}
-			
-			if (ev[i].events & EPOLLIN) {
-				if (read_event(fd) == FALSE) {
-					rm_from_epoll(fd);
-					close(fd);
-				}
-			}
-
-			if (ev[i].events & EPOLLERR) {
-				TRACE_INFO("Error occured on connection %d, closing the connection.\n", fd);
-				close(fd);
-			}
+	// The ring accepts and serves everything on this thread. Without
+	// io_uring support we fall back to the epoll reactors.
+	if (use_uring) {
+		if (init_uring_server() == TRUE) {
+			nb_reactors = 0;
+		} else {
+			TRACE_ERROR("Falling back to epoll\n");
+			use_uring = FALSE;
 		}
+	}
 
-		if (do_accept) {
-			while (accept_conn())
-				;
-			do_accept = FALSE;
+	// Only the acceptor (main) thread should handle SIGINT, the reactors
+	// are woken up explicitly through their eventfd. The trace signals have
+	// to interrupt its epoll_wait as well.
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGUSR1);
+	sigaddset(&sigset, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+
+	// The rings have to be there before the reactors read anything
+	if (nb_workers && pipeline_init(reactors, nb_reactors) == FALSE) nb_workers = 0;
+	for (started = 0; started < nb_reactors && !force_quit; started++) {
+		if (init_reactor(&reactors[started], started) == FALSE) break;
+		if (pthread_create(&reactors[started].thread, NULL, run_reactor, &reactors[started]) != 0) {
+			TRACE_ERROR("Unable to start reactor %d\n", started);
+			close(reactors[started].wake_fd);
+			close(reactors[started].epoll_fd);
+			break;
+		}
+	}
+	if (started != nb_reactors) {
+		force_quit = TRUE;
+		nb_reactors = started;
+	}
+	// They hand the associations to the reactors, so they come after them
+	for (started = 0; started < nb_acceptors && !force_quit; started++) {
+		if (init_acceptor(&acceptors[started], started) == FALSE) break;
+		if (pthread_create(&acceptors[started].thread, NULL, run_acceptor, &acceptors[started]) != 0) {
+			TRACE_ERROR("Unable to start acceptor %d\n", started);
+			close(acceptors[started].wake_fd);
+			close(acceptors[started].epoll_fd);
+			close(acceptors[started].listen_fd);
+			break;
 		}
 	}
+	if (started != nb_acceptors) {
+		force_quit = TRUE;
+		nb_acceptors = started;
+	}
+#ifdef RATE
+	if (report_interval && !force_quit) {
+		if (use_uring || model != MODEL_STREAM) counters[nb_counters++] = &shared_stats.io;
+		for (int i = 0; i < nb_reactors; i++) counters[nb_counters++] = &reactors[i].stats.io;
+		reporting = start_reporter(&reporter, counters, nb_counters, report_interval);
+	}
+#endif
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	TRACE_INFO("Started %d reactors\n", nb_reactors);
+	if (nb_acceptors) TRACE_INFO("Started %d acceptors, backlog %d\n", nb_acceptors, backlog);
+
+	if (use_uring) run_uring_server();
+	if (model != MODEL_STREAM) run_seqpacket();
+	// With acceptors there is nothing in the epoll, we only wake up for
+	// the signals
+	while (!force_quit) {
+		TRACE_DEBUG("Wating for new associations...\n");
+		nb_ev = epoll_wait(accept_epoll_fd, ev, BURST_SIZE, -1);
+		trace_poll();
+		if (nb_ev <= 0) continue;
+
+		while (accept_conn(server_sock)) nb_accepted++;
+	}
+
+	// Before the reactors, nothing is handed over to them after this
+	stop_acceptors(nb_acceptors);
+	if (nb_workers) pipeline_stop();
+	for (int i = 0; i < nb_reactors; i++) wake_reactor(&reactors[i]);
+	for (int i = 0; i < nb_reactors; i++) {
+		pthread_join(reactors[i].thread, NULL);
+		close(reactors[i].wake_fd);
+		close(reactors[i].epoll_fd);
+	}
 
-	close(server_sock);
-	close(epoll_fd);
+	if (server_sock != -1) close(server_sock);
+	close(accept_epoll_fd);
 
 #ifdef RATE
-	double rx_elapsed = MICRO_TO_SEC(rx_end_ts - rx_start_ts);
-	double tx_elapsed = MICRO_TO_SEC(tx_end_ts - tx_start_ts);
-
-	TRACE_INFO("The total time it took for rx: %0.4f sec\n", rx_elapsed);
-	TRACE_INFO("The total time it took for rx: %0.4f sec\n", tx_elapsed);
-	TRACE_INFO("Received %ld bytes and sent %ld bytes\n", rx, tx);
-	TRACE_INFO("RX rate: %0.4fGbps | TX rate: %0.4fGbps\n",
-				BYTES_TO_BITS(BYTES_TO_GB(rx)) / rx_elapsed,
-				BYTES_TO_BITS(BYTES_TO_GB(tx)) / tx_elapsed);
+	if (reporting) stop_reporter(&reporter);
 #endif
+	print_stats();
+	if (nb_workers) pipeline_free();
+	trace_exit();
 	exit(EXIT_SUCCESS);
 
 failed_exit:
-	close(server_sock);
+	if (server_sock != -1) close(server_sock);
 listener_failed:
 	exit(EXIT_FAILURE);
 }
@@ -0,0 +1,208 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <pthread.h>
+#include <netinet/sctp.h>
+
+#include "common.h"
+#include "outq.h"
+#include "report.h"
+#include "policy.h"
+#include "reasm.h"
+#include "tune.h"
+#include "trace.h"
+#include "pipeline.h"
+
+#define EPOLL_SIZE (1024)
+#define BURST_SIZE (32)
+#define MAX_BUFF (1024)
+#define BACKLOG (1024)
+#define PORT (8877)
+
+// Inbound and outbound streams offered to every association
+#define DEFAULT_STREAMS (5)
+#define MAX_STREAMS (65535)
+
+#define DEFAULT_REACTORS (1)
+#define MAX_REACTORS (64)
+
+// Threads accepting on listeners of their own, 0 accepts on the main thread
+#define DEFAULT_ACCEPTORS (0)
+#define MAX_ACCEPTORS (16)
+
+// Messages read from one connection per wakeup in edge-triggered mode, and
+// from the one-to-many socket
+#define DEFAULT_READ_BUDGET (16)
+
+// Messages per second above which an association gets its own fd
+#define DEFAULT_PEEL_THRESHOLD (10000)
+// Interval over which the per association message rate is measured
+#define PEEL_WINDOW_NANO (NSEC_PER_SEC)
+
+typedef enum {
+	PLACE_ROUND_ROBIN,
+	PLACE_LEAST_LOADED,
+} placement_t;
+
+// How associations are mapped onto sockets
+typedef enum {
+	// One-to-one, every association is accepted on its own fd
+	MODEL_STREAM,
+	// One-to-many, every association shares the listening socket
+	MODEL_SEQPACKET,
+	// One-to-many, but hot associations are peeled off to the reactors
+	MODEL_HYBRID,
+} model_t;
+
+// Only written by the thread it belongs to, and kept on cache lines of its
+// own so the reactors don't false-share them
+typedef struct reactor_stats {
+	// Bytes and messages, sampled by the reporter
+	counters_t io;
+	// Messages that had to wait for EPOLLOUT and times reading was paused
+	size_t queued;
+	size_t paused;
+
+	// Syscall accounting to compare the level and edge triggered modes
+	size_t wakeups;
+	size_t waits;
+	size_t reads;
+	size_t writes;
+	size_t ctls;
+	// Hybrid busy polling: epoll_waits that found nothing while spinning,
+	// wakeups the spinning caught and times the reactor blocked
+	size_t spins;
+	size_t spin_wakeups;
+	size_t sleeps;
+	// Pipeline mode: messages handed to the workers, times a ring to a
+	// worker was full, and how long the replies waited for us
+	size_t handoffs;
+	size_t stalls;
+	nano_ts_t back_ns;
+	// Echoes PR-SCTP gave up on, taken from the associations this thread
+	// closed
+	abandoned_t abandoned;
+#ifdef RATE
+	nano_ts_t rx_start_ts, rx_end_ts;
+	nano_ts_t tx_start_ts, tx_end_ts;
+	// Taken once per wakeup and used for everything done in it, the rates
+	// don't need a timestamp per message
+	nano_ts_t now;
+#endif
+} __attribute__((aligned(CACHE_LINE))) reactor_stats_t;
+
+struct conn;
+
+typedef struct reactor {
+	int id;
+	pthread_t thread;
+	int epoll_fd;
+	// Used by the acceptor to kick the reactor out of epoll_wait
+	int wake_fd;
+
+	// The acceptor adds connections, the reactor removes them
+	pthread_mutex_t lock;
+	struct conn *conns;
+	int nb_conns;
+
+	// Connections that ran out of read budget with data still pending
+	struct conn *ready;
+	// Blocked in epoll_wait, the workers have to wake us up for replies
+	int sleeping;
+
+	// Every message buffer of the reactor's connections comes from here,
+	// the next message is read into rx_buf
+	bufpool_t pool;
+	uint8_t *rx_buf;
+	size_t rx_cap;
+
+	reactor_stats_t stats;
+} reactor_t;
+
+typedef struct conn {
+	int sockid;
+	reactor_t *reactor;
+	struct conn *prev, *next;
+
+	// Events currently registered with the reactor's epoll
+	int events;
+	int read_paused;
+	outq_t outq;
+	// Messages that arrive in pieces
+	reasm_t reasm;
+
+	int on_ready;
+	struct conn *ready_next;
+
+	// Pipeline mode: the worker of the connection and the messages it
+	// has of ours. A connection closed in the meantime is only freed once
+	// they are all back.
+	int worker;
+	int inflight;
+	int closed;
+} conn_t;
+
+// A thread accepting on a SO_REUSEPORT listener of its own, the kernel
+// spreads the new associations over the listeners
+typedef struct acceptor {
+	int id;
+	pthread_t thread;
+	int listen_fd;
+	int epoll_fd;
+	// Written by the main thread to get it out of epoll_wait
+	int wake_fd;
+
+	size_t accepted;
+} acceptor_t;
+
+extern int server_sock;
+extern int accept_epoll_fd;
+extern int force_quit;
+
+extern model_t model;
+extern int use_uring;
+extern int read_budget;
+extern nano_ts_t spin_budget;
+extern int busy_poll;
+extern int peel_threshold;
+extern int nb_streams;
+extern int interleave;
+extern size_t nb_peeled;
+// Stats of the thread serving the one-to-many socket
+extern reactor_stats_t shared_stats;
+extern bufpool_t shared_pool;
+
+// Asks for the sctp_sndrcvinfo of every message read from the socket and
+// for aborted partial deliveries, and for the association change
+// notifications if assoc_events is set
+int subscribe_events(int sockid, int assoc_events);
+
+// Drops what arrived of a message whose partial delivery was aborted
+void handle_pd_event(reasm_t *r, union sctp_notification *sn);
+
+int add_to_epoll(int epoll_fd, int events, int fd, void *ptr);
+int mod_epoll(int epoll_fd, int events, int fd, void *ptr);
+int rm_from_epoll(int epoll_fd, int fd);
+
+// Opens a nonblocking listening socket, type is SOCK_STREAM for one-to-one
+// and SOCK_SEQPACKET for one-to-many associations. Returns -1 on failure.
+int open_listener(int type);
+// Accepts one association on the listener and hands it over to a reactor
+int accept_conn(int listen_fd);
+// Hands a connected nonblocking socket over to one of the reactors
+int assign_conn(int sockid);
+void close_conn(conn_t *conn);
+
+// Echoes the message in buffer, which is taken over. Returns FALSE if the
+// connection has to be closed.
+int handle_write(conn_t *conn, uint8_t *buffer, size_t len, uint16_t stream, size_t cap);
+
+// Serves every association on the one-to-many server_sock until force_quit
+void run_seqpacket();
+
+// Sets up the ring, returns FALSE if io_uring is not usable here
+int init_uring_server();
+// Accepts and serves every association on the ring until force_quit
+void run_uring_server();
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "debug.h"
+#include "common.h"
+#include "timing.h"
+
+// How long the TSC is measured against CLOCK_MONOTONIC
+#define CALIBRATE_NANO (50 * 1000 * 1000)
+#define SELFTEST_CALLS (1000000)
+
+tsc_clock_t tsc_clock;
+
+// The TSC is only usable as a clock if it ticks at a constant rate in
+// every P- and C-state and doesn't stop in deep sleep
+static int tsc_invariant() {
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+		return FALSE;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx >> 8) & 1;
+#else
+	return FALSE;
+#endif
+}
+
+void timing_init() {
+	uint64_t tsc_start, tsc_end;
+	nano_ts_t ns_start, ns_end;
+
+	tsc_clock.enabled = FALSE;
+	if (!tsc_invariant()) {
+		TRACE_INFO("No invariant TSC, timestamps come from CLOCK_MONOTONIC\n");
+		return;
+	}
+
+	ns_start = monotonic_ns();
+	tsc_start = rdtsc();
+	do {
+		ns_end = monotonic_ns();
+		tsc_end = rdtsc();
+	} while (ns_end - ns_start < CALIBRATE_NANO);
+
+	if (tsc_end <= tsc_start) {
+		TRACE_ERROR("The TSC went backwards while calibrating, using CLOCK_MONOTONIC\n");
+		return;
+	}
+
+	tsc_clock.mult = ((unsigned __int128)(ns_end - ns_start) << TSC_SHIFT) / (tsc_end - tsc_start);
+	tsc_clock.base_tsc = tsc_end;
+	tsc_clock.base_ns = ns_end;
+	tsc_clock.enabled = TRUE;
+	TRACE_INFO("Timestamps come from the TSC at %0.3fGHz\n",
+				(double)(tsc_end - tsc_start) / (ns_end - ns_start));
+}
+
+const char *timing_source() {
+	return tsc_clock.enabled ? "TSC" : "CLOCK_MONOTONIC";
+}
+
+void timing_selftest() {
+	nano_ts_t start, end, tsc_ns, mono_ns;
+	volatile uint64_t sink = 0;
+	struct timeval tv;
+
+	printf("Clock source in use: %s\n", timing_source());
+
+	start = monotonic_ns();
+	for (int i = 0; i < SELFTEST_CALLS; i++) sink += monotonic_ns();
+	end = monotonic_ns();
+	printf("clock_gettime(CLOCK_MONOTONIC): %0.1fns per call\n",
+			(double)(end - start) / SELFTEST_CALLS);
+
+	start = monotonic_ns();
+	for (int i = 0; i < SELFTEST_CALLS; i++) {
+		gettimeofday(&tv, NULL);
+		sink += tv.tv_usec;
+	}
+	end = monotonic_ns();
+	printf("gettimeofday: %0.1fns per call\n", (double)(end - start) / SELFTEST_CALLS);
+
+	if (!tsc_clock.enabled) return;
+
+	start = monotonic_ns();
+	for (int i = 0; i < SELFTEST_CALLS; i++) sink += rdtsc();
+	end = monotonic_ns();
+	printf("rdtsc: %0.1fns per call\n", (double)(end - start) / SELFTEST_CALLS);
+
+	start = monotonic_ns();
+	for (int i = 0; i < SELFTEST_CALLS; i++) sink += nano_ts();
+	end = monotonic_ns();
+	printf("nano_ts (scaled TSC): %0.1fns per call\n", (double)(end - start) / SELFTEST_CALLS);
+
+	tsc_ns = nano_ts();
+	mono_ns = monotonic_ns();
+	printf("TSC is %+0.1fus off CLOCK_MONOTONIC since calibration\n",
+			((double)tsc_ns - (double)mono_ns) * 1e-3);
+}
@@ -0,0 +1,74 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// Monotonic integer nanosecond timestamps. On x86 with an invariant TSC
+// they come from rdtsc, scaled with a factor calibrated against
+// CLOCK_MONOTONIC by timing_init. Everywhere else, or before timing_init,
+// they come from clock_gettime(CLOCK_MONOTONIC).
+
+typedef uint64_t nano_ts_t;
+
+#define NSEC_PER_SEC (1000000000ULL)
+
+#define SEC_TO_NANO(sec) ((sec) * 1e9)
+#define NANO_TO_SEC(nano) ((nano) * 1e-9)
+#define NANO_TO_MICRO(nano) ((nano) * 1e-3)
+
+// Fractional bits of the cycles to nanoseconds factor
+#define TSC_SHIFT (32)
+
+typedef struct tsc_clock {
+	int enabled;
+	uint64_t base_tsc;
+	nano_ts_t base_ns;
+	// Nanoseconds per cycle, fixed point with TSC_SHIFT fractional bits
+	uint64_t mult;
+} tsc_clock_t;
+
+extern tsc_clock_t tsc_clock;
+
+static inline nano_ts_t monotonic_ns() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (nano_ts_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t rdtsc() {
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+#else
+static inline uint64_t rdtsc() {
+	return 0;
+}
+#endif
+
+// Returns a monotonic timestamp in nanoseconds, only meaningful as a
+// difference with another one
+static inline nano_ts_t nano_ts() {
+	if (tsc_clock.enabled) {
+		return tsc_clock.base_ns +
+			(((unsigned __int128)(rdtsc() - tsc_clock.base_tsc) * tsc_clock.mult) >> TSC_SHIFT);
+	}
+	return monotonic_ns();
+}
+
+// Picks the clock source, calibrating the TSC if it can be used. Has to
+// run before any thread takes a timestamp.
+void timing_init();
+
+// Returns the name of the clock source nano_ts uses
+const char *timing_source();
+
+// Prints the cost of a call to every clock source and how far the TSC
+// drifted from CLOCK_MONOTONIC during the test
+void timing_selftest();
+
+#endif /* TIMING_H_ */
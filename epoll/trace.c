@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "common.h"
+#include "trace.h"
+
+volatile int trace_enabled = FALSE;
+__thread trace_ring_t *trace_ring;
+
+static const char *trace_path;
+static volatile int dump_pending = FALSE;
+static __thread char thread_name[TRACE_NAME_LEN];
+// Out of rings or memory, the thread doesn't record anything
+static __thread int ring_failed;
+
+static trace_ring_t *rings[TRACE_MAX_RINGS];
+static int nb_rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void handle_sigusr(int sig) {
+	if (sig == SIGUSR1) dump_pending = TRUE;
+	else trace_enabled = !trace_enabled;
+}
+
+void trace_init(const char *path) {
+	trace_path = path;
+	trace_enabled = TRUE;
+	signal(SIGUSR1, handle_sigusr);
+	signal(SIGUSR2, handle_sigusr);
+	TRACE_INFO("Tracing into %s, SIGUSR1 writes it out and SIGUSR2 pauses or resumes it\n", path);
+}
+
+void trace_thread(const char *name, int id) {
+	if (id < 0) snprintf(thread_name, sizeof(thread_name), "%s", name);
+	else snprintf(thread_name, sizeof(thread_name), "%s %d", name, id);
+	if (trace_ring) memcpy(trace_ring->name, thread_name, TRACE_NAME_LEN);
+}
+
+// Only called the first time a thread records something
+trace_ring_t *trace_ring_new() {
+	trace_ring_t *ring;
+
+	if (ring_failed) return NULL;
+	pthread_mutex_lock(&rings_lock);
+	if (nb_rings == TRACE_MAX_RINGS) goto unlock_return;
+	ring = malloc(sizeof(trace_ring_t));
+	if (ring == NULL) goto unlock_return;
+
+	ring->head = 0;
+	if (thread_name[0]) memcpy(ring->name, thread_name, TRACE_NAME_LEN);
+	else snprintf(ring->name, TRACE_NAME_LEN, "thread %d", nb_rings);
+	rings[nb_rings++] = ring;
+	trace_ring = ring;
+
+unlock_return:
+	pthread_mutex_unlock(&rings_lock);
+	if (trace_ring == NULL) {
+		TRACE_ERROR("Unable to set up a trace ring for this thread\n");
+		ring_failed = TRUE;
+	}
+	return trace_ring;
+}
+
+// Writes the events of a ring, oldest first. The ones the thread
+// overwrites while we copy them may come out torn, only the dump at exit
+// is guaranteed to be consistent.
+static int dump_ring(FILE *f, trace_ring_t *ring, size_t *events) {
+	trace_ring_hdr_t hdr;
+	uint64_t head, start, first;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.name, ring->name, TRACE_NAME_LEN);
+	hdr.count = MIN(head, TRACE_RING_SIZE);
+	hdr.lost = head - hdr.count;
+	start = hdr.lost & (TRACE_RING_SIZE - 1);
+	first = MIN(hdr.count, TRACE_RING_SIZE - start);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) return FALSE;
+	if (fwrite(&ring->recs[start], sizeof(trace_rec_t), first, f) != first) return FALSE;
+	if (fwrite(ring->recs, sizeof(trace_rec_t), hdr.count - first, f) != hdr.count - first)
+		return FALSE;
+	*events += hdr.count;
+	return TRUE;
+}
+
+static void trace_dump() {
+	FILE *f;
+	size_t events = 0;
+	trace_file_hdr_t hdr;
+
+	f = fopen(trace_path, "w");
+	if (f == NULL) {
+		TRACE_ERROR("Unable to open %s, error: %s\n", trace_path, strerror(errno));
+		return;
+	}
+
+	pthread_mutex_lock(&rings_lock);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	hdr.version = TRACE_VERSION;
+	hdr.nb_rings = nb_rings;
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) goto failed_return;
+	for (int i = 0; i < nb_rings; i++) {
+		if (dump_ring(f, rings[i], &events) == FALSE) goto failed_return;
+	}
+	pthread_mutex_unlock(&rings_lock);
+
+	if (fclose(f) != 0) {
+		TRACE_ERROR("Unable to write %s, error: %s\n", trace_path, strerror(errno));
+		return;
+	}
+	TRACE_INFO("Wrote %ld events of %d threads to %s\n", events, hdr.nb_rings, trace_path);
+	return;
+
+failed_return:
+	pthread_mutex_unlock(&rings_lock);
+	TRACE_ERROR("Unable to write %s, error: %s\n", trace_path, strerror(errno));
+	fclose(f);
+}
+
+void trace_poll() {
+	if (!dump_pending) return;
+	dump_pending = FALSE;
+	trace_dump();
+}
+
+void trace_exit() {
+	if (trace_path) trace_dump();
+}
@@ -0,0 +1,113 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#include "timing.h"
+
+// Binary trace of the hot paths. Every thread records fixed size events
+// into a ring of its own, without locks or formatting, and the oldest ones
+// are overwritten once it is full. The rings are written to a file on
+// exit and on SIGUSR1, SIGUSR2 turns the recording on and off, and
+// tracedump prints the file with the messages the events stand for.
+
+// Events per ring, a power of two
+#define TRACE_RING_SIZE (1 << 16)
+// Threads that can record at once
+#define TRACE_MAX_RINGS (256)
+#define TRACE_NAME_LEN (16)
+
+#define TRACE_MAGIC "SCTPTRC"
+#define TRACE_VERSION (1)
+
+// Every event keeps the fd (or association) it happened on, a byte count
+// and whatever else its message needs in arg and stream
+typedef enum trace_ev {
+	TR_ACCEPT,		// fd
+	TR_WAIT,		// arg: reactor
+	TR_WAKEUP,		// arg: reactor, bytes: events
+	TR_EVENT,		// fd, arg: index in the burst
+	TR_EVENTS,		// fd, bytes: old events, arg: new events
+	TR_READ,		// fd, bytes, stream
+	TR_WRITE,		// fd, bytes: tried, arg: written
+	TR_QUEUE,		// fd, bytes, arg: pending
+	TR_FLUSH,		// fd, bytes: tried, arg: written
+	TR_PAUSE,		// fd
+	TR_RESUME,		// fd
+	TR_ASSOC_READ,	// fd: association, bytes, stream
+	TR_ASSOC_WRITE,	// fd: association, bytes: tried, arg: written
+	TR_SHARED_PAUSE,
+	TR_SHARED_RESUME,
+	TR_URING_READ,	// fd, bytes, arg: buffer
+	TR_BATCH,		// fd, arg: messages
+	TR_INFLIGHT,	// fd, arg: messages
+	TR_LOST,		// fd, arg: messages
+	TR_CLOSE,		// fd, arg: reactor, -1 on the ring
+	TR_MAX,
+} trace_ev_t;
+
+typedef struct trace_rec {
+	nano_ts_t ts;
+	int64_t bytes;
+	int64_t arg;
+	int32_t fd;
+	uint16_t id;
+	uint16_t stream;
+} trace_rec_t;
+
+typedef struct trace_ring {
+	char name[TRACE_NAME_LEN];
+	// Events recorded so far, only ever written by the owning thread
+	uint64_t head;
+	trace_rec_t recs[TRACE_RING_SIZE];
+} trace_ring_t;
+
+// What the file starts with, followed by every ring as a trace_ring_hdr_t
+// and its events, oldest first
+typedef struct trace_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nb_rings;
+} trace_file_hdr_t;
+
+typedef struct trace_ring_hdr {
+	char name[TRACE_NAME_LEN];
+	uint64_t count;
+	// Overwritten before the dump
+	uint64_t lost;
+} trace_ring_hdr_t;
+
+extern volatile int trace_enabled;
+extern __thread trace_ring_t *trace_ring;
+
+// Starts recording, the rings go to path
+void trace_init(const char *path);
+// Names the ring of the calling thread, e.g. "reactor 2", or just name
+// with a negative id
+void trace_thread(const char *name, int id);
+trace_ring_t *trace_ring_new();
+// Writes the rings if SIGUSR1 asked for it, on the thread that waits for
+// signals
+void trace_poll();
+// Writes the rings, once the other threads are gone
+void trace_exit();
+
+static inline void trace_event(trace_ev_t id, int fd, int64_t bytes, int64_t arg, uint16_t stream) {
+	trace_ring_t *ring = trace_ring;
+	trace_rec_t *rec;
+
+	if (__builtin_expect(!trace_enabled, 1)) return;
+	if (ring == NULL && (ring = trace_ring_new()) == NULL) return;
+
+	rec = &ring->recs[ring->head & (TRACE_RING_SIZE - 1)];
+	rec->ts = nano_ts();
+	rec->bytes = bytes;
+	rec->arg = arg;
+	rec->fd = fd;
+	rec->id = id;
+	rec->stream = stream;
+	// A dump that runs concurrently only looks at the published events
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* TRACE_H_ */
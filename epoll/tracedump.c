@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "common.h"
+#include "trace.h"
+
+// Prints a trace written by the server or the client with -g, the events
+// of all the threads merged in time order, with the messages they used to
+// be traced with
+
+typedef struct event {
+	trace_rec_t rec;
+	int ring;
+} event_t;
+
+static char names[TRACE_MAX_RINGS][TRACE_NAME_LEN];
+
+static int cmp_events(const void *a, const void *b) {
+	const event_t *x = a, *y = b;
+
+	if (x->rec.ts != y->rec.ts) return x->rec.ts < y->rec.ts ? -1 : 1;
+	return x->ring - y->ring;
+}
+
+void print_event(trace_rec_t *rec) {
+	long bytes = rec->bytes, arg = rec->arg;
+	int fd = rec->fd, stream = rec->stream;
+
+	switch (rec->id) {
+		case TR_ACCEPT:
+			printf("Accepted a new client %d\n", fd);
+			break;
+		case TR_WAIT:
+			printf("Reactor %ld wating for futher events...\n", arg);
+			break;
+		case TR_WAKEUP:
+			printf("Reactor %ld got %ld events from epoll_wait\n", arg, bytes);
+			break;
+		case TR_EVENT:
+			printf("Processign %ld event, Got an event againt fd: %d\n", arg, fd);
+			break;
+		case TR_EVENTS:
+			printf("Connection %d events changed from 0x%lx to 0x%lx\n", fd, bytes, arg);
+			break;
+		case TR_READ:
+			printf("Received %ld bytes from client on stream %d\n", bytes, stream);
+			break;
+		case TR_WRITE:
+			printf("Tried to send %ld bytes, sent %ld\n", bytes, arg);
+			break;
+		case TR_QUEUE:
+			printf("Queued %ld bytes on connection %d, %ld bytes pending\n", bytes, fd, arg);
+			break;
+		case TR_FLUSH:
+			printf("Tried to flush %ld bytes, sent %ld\n", bytes, arg);
+			break;
+		case TR_PAUSE:
+			printf("Pausing reads on connection %d\n", fd);
+			break;
+		case TR_RESUME:
+			printf("Resuming reads on connection %d\n", fd);
+			break;
+		case TR_ASSOC_READ:
+			printf("Received %ld bytes from association %d on stream %d\n", bytes, fd, stream);
+			break;
+		case TR_ASSOC_WRITE:
+			printf("Tried to send %ld bytes to association %d, sent %ld\n", bytes, fd, arg);
+			break;
+		case TR_SHARED_PAUSE:
+			printf("Pausing reads on the one-to-many socket\n");
+			break;
+		case TR_SHARED_RESUME:
+			printf("Resuming reads on the one-to-many socket\n");
+			break;
+		case TR_URING_READ:
+			printf("Received %ld bytes from client into buffer %ld\n", bytes, arg);
+			break;
+		case TR_BATCH:
+			printf("Wrote a batch of %ld messages on %d\n", arg, fd);
+			break;
+		case TR_INFLIGHT:
+			printf("%ld messages in flight, waiting for echoes\n", arg);
+			break;
+		case TR_LOST:
+			printf("%ld messages on %d are lost\n", arg, fd);
+			break;
+		case TR_CLOSE:
+			if (arg < 0) printf("Closing connection %d\n", fd);
+			else printf("Closing connection %d on reactor %ld\n", fd, arg);
+			break;
+		default:
+			printf("Unknown event %d on %d, %ld bytes, %ld\n", rec->id, fd, bytes, arg);
+			break;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	FILE *f;
+	size_t nb_events = 0, cap = 0;
+	event_t *events = NULL, *grown;
+	trace_file_hdr_t hdr;
+	trace_ring_hdr_t ring;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	f = fopen(argv[1], "r");
+	if (f == NULL) {
+		TRACE_ERROR("Unable to open %s, error: %s\n", argv[1], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+		memcmp(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+		hdr.version != TRACE_VERSION || hdr.nb_rings > TRACE_MAX_RINGS) {
+		TRACE_ERROR("%s is not a trace\n", argv[1]);
+		goto failed_exit;
+	}
+
+	for (int i = 0; i < hdr.nb_rings; i++) {
+		if (fread(&ring, sizeof(ring), 1, f) != 1 || ring.count > TRACE_RING_SIZE) goto truncated;
+		memcpy(names[i], ring.name, TRACE_NAME_LEN);
+		names[i][TRACE_NAME_LEN - 1] = '\0';
+		if (ring.lost) {
+			TRACE_INFO("%s: the first %ld events were overwritten\n", names[i], ring.lost);
+		}
+
+		if (nb_events + ring.count > cap) {
+			cap = MAX(2 * cap, nb_events + ring.count);
+			grown = realloc(events, cap * sizeof(event_t));
+			if (grown == NULL) {
+				TRACE_ERROR("Unable to allocate %ld events\n", cap);
+				goto failed_exit;
+			}
+			events = grown;
+		}
+		for (uint64_t n = 0; n < ring.count; n++, nb_events++) {
+			if (fread(&events[nb_events].rec, sizeof(trace_rec_t), 1, f) != 1) goto truncated;
+			events[nb_events].ring = i;
+		}
+	}
+	fclose(f);
+
+	qsort(events, nb_events, sizeof(event_t), cmp_events);
+	for (size_t i = 0; i < nb_events; i++) {
+		printf("%14.3f %-*s ", NANO_TO_MICRO((double)(events[i].rec.ts - events[0].rec.ts)),
+			   TRACE_NAME_LEN, names[events[i].ring]);
+		print_event(&events[i].rec);
+	}
+	free(events);
+	exit(EXIT_SUCCESS);
+
+truncated:
+	TRACE_ERROR("%s is truncated\n", argv[1]);
+failed_exit:
+	free(events);
+	fclose(f);
+	exit(EXIT_FAILURE);
+}
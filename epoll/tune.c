@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+
+#include "debug.h"
+#include "common.h"
+#include "tune.h"
+
+#define UNSET_TUNE(n) { \
+	.name = n, .sndbuf = -1, .rcvbuf = -1, .nodelay = -1, .maxseg = -1, \
+	.sack_delay = -1, .sack_freq = -1, .rto_initial = -1, .rto_min = -1, .rto_max = -1, \
+	.backlog = -1, .streams = -1, \
+}
+
+tune_t tuning = UNSET_TUNE("default");
+
+static tune_t profiles[MAX_PROFILES] = {
+	UNSET_TUNE("default"),
+	// Every message and every SACK goes out right away, and losses are
+	// noticed quickly on a LAN
+	{
+		.name = "low-latency", .sndbuf = -1, .rcvbuf = -1, .nodelay = 1, .maxseg = -1,
+		.sack_delay = -1, .sack_freq = 1, .rto_initial = 100, .rto_min = 10, .rto_max = 1000,
+		.backlog = -1, .streams = -1,
+	},
+	// Large buffers to keep a long fat pipe full, and fewer SACKs
+	{
+		.name = "bulk", .sndbuf = 4 * 1024 * 1024, .rcvbuf = 4 * 1024 * 1024, .nodelay = 0,
+		.maxseg = -1, .sack_delay = 200, .sack_freq = 4, .rto_initial = -1, .rto_min = -1,
+		.rto_max = -1, .backlog = -1, .streams = -1,
+	},
+};
+static int nb_profiles = 3;
+
+static const struct {
+	const char *key;
+	size_t off;
+} settings[] = {
+	{"sndbuf", offsetof(tune_t, sndbuf)},
+	{"rcvbuf", offsetof(tune_t, rcvbuf)},
+	{"nodelay", offsetof(tune_t, nodelay)},
+	{"maxseg", offsetof(tune_t, maxseg)},
+	{"sack_delay", offsetof(tune_t, sack_delay)},
+	{"sack_freq", offsetof(tune_t, sack_freq)},
+	{"rto_initial", offsetof(tune_t, rto_initial)},
+	{"rto_min", offsetof(tune_t, rto_min)},
+	{"rto_max", offsetof(tune_t, rto_max)},
+	{"backlog", offsetof(tune_t, backlog)},
+	{"streams", offsetof(tune_t, streams)},
+};
+#define NB_SETTINGS (sizeof(settings) / sizeof(settings[0]))
+
+static inline int *setting(tune_t *t, int i) {
+	return (int *)((char *)t + settings[i].off);
+}
+
+static char *trim(char *s) {
+	char *end;
+
+	while (isspace((unsigned char)*s)) s++;
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) end--;
+	*end = '\0';
+	return s;
+}
+
+static tune_t *find_profile(const char *name) {
+	for (int i = 0; i < nb_profiles; i++) {
+		if (strcmp(profiles[i].name, name) == 0) return &profiles[i];
+	}
+	return NULL;
+}
+
+// Starts a profile of the file, from scratch even if it was built in
+static tune_t *new_profile(const char *name) {
+	tune_t *t = find_profile(name);
+	tune_t unset = UNSET_TUNE("");
+
+	if (strlen(name) >= PROFILE_NAME_LEN) return NULL;
+	if (t == NULL) {
+		if (nb_profiles == MAX_PROFILES) return NULL;
+		t = &profiles[nb_profiles++];
+	}
+	*t = unset;
+	strcpy(t->name, name);
+	return t;
+}
+
+static int parse_setting(tune_t *t, char *line) {
+	char *eq, *key, *end;
+	long value;
+
+	eq = strchr(line, '=');
+	if (eq == NULL) return FALSE;
+	*eq = '\0';
+	key = trim(line);
+
+	value = strtol(trim(eq + 1), &end, 10);
+	if (end == trim(eq + 1) || *end != '\0' || value < 0 || value > INT32_MAX) return FALSE;
+
+	for (int i = 0; i < NB_SETTINGS; i++) {
+		if (strcmp(settings[i].key, key) == 0) {
+			*setting(t, i) = value;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+int tune_load(const char *path) {
+	FILE *f;
+	char buf[256], *line, *p;
+	int n = 0;
+	tune_t *t = NULL;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		TRACE_ERROR("Unable to open %s, error: %s\n", path, strerror(errno));
+		return FALSE;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		n++;
+		if ((p = strchr(buf, '#')) != NULL) *p = '\0';
+		line = trim(buf);
+		if (*line == '\0') continue;
+
+		if (*line == '[') {
+			p = strchr(line, ']');
+			if (p == NULL || p[1] != '\0') goto parse_failed;
+			*p = '\0';
+			t = new_profile(trim(line + 1));
+			if (t == NULL) goto parse_failed;
+		} else if (t == NULL || parse_setting(t, line) == FALSE) {
+			goto parse_failed;
+		}
+	}
+	fclose(f);
+	return TRUE;
+
+parse_failed:
+	TRACE_ERROR("Unable to parse line %d of %s\n", n, path);
+	fclose(f);
+	return FALSE;
+}
+
+int tune_select(const char *name, tune_t *t) {
+	tune_t *p = find_profile(name);
+
+	if (p == NULL) return FALSE;
+	*t = *p;
+	return TRUE;
+}
+
+void tune_describe(const tune_t *t, char *buf, size_t len) {
+	size_t n;
+
+	n = snprintf(buf, len, "%s", t->name);
+	for (int i = 0; i < NB_SETTINGS && n < len; i++) {
+		if (*setting((tune_t *)t, i) < 0) continue;
+		n += snprintf(buf + n, len - n, " %s=%d", settings[i].key, *setting((tune_t *)t, i));
+	}
+}
+
+int tune_apply(int sockid, const tune_t *t) {
+	int ret;
+	struct sctp_assoc_value av;
+	struct sctp_sack_info sack;
+	struct sctp_rtoinfo rto;
+
+	if (t->sndbuf >= 0) {
+		ret = setsockopt(sockid, SOL_SOCKET, SO_SNDBUF, &t->sndbuf, sizeof(t->sndbuf));
+		if (ret == -1) goto failed;
+	}
+	if (t->rcvbuf >= 0) {
+		ret = setsockopt(sockid, SOL_SOCKET, SO_RCVBUF, &t->rcvbuf, sizeof(t->rcvbuf));
+		if (ret == -1) goto failed;
+	}
+	if (t->nodelay >= 0) {
+		ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_NODELAY, &t->nodelay, sizeof(t->nodelay));
+		if (ret == -1) goto failed;
+	}
+	if (t->maxseg >= 0) {
+		memset(&av, 0, sizeof(av));
+		av.assoc_id = SCTP_FUTURE_ASSOC;
+		av.assoc_value = t->maxseg;
+		ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_MAXSEG, &av, sizeof(av));
+		if (ret == -1) goto failed;
+	}
+	if (t->sack_delay >= 0 || t->sack_freq >= 0) {
+		// Zero leaves either one as it is
+		memset(&sack, 0, sizeof(sack));
+		sack.sack_assoc_id = SCTP_FUTURE_ASSOC;
+		sack.sack_delay = MAX(t->sack_delay, 0);
+		sack.sack_freq = MAX(t->sack_freq, 0);
+		ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_DELAYED_SACK, &sack, sizeof(sack));
+		if (ret == -1) goto failed;
+	}
+	if (t->rto_initial >= 0 || t->rto_min >= 0 || t->rto_max >= 0) {
+		// Same here
+		memset(&rto, 0, sizeof(rto));
+		rto.srto_assoc_id = SCTP_FUTURE_ASSOC;
+		rto.srto_initial = MAX(t->rto_initial, 0);
+		rto.srto_min = MAX(t->rto_min, 0);
+		rto.srto_max = MAX(t->rto_max, 0);
+		ret = setsockopt(sockid, IPPROTO_SCTP, SCTP_RTOINFO, &rto, sizeof(rto));
+		if (ret == -1) goto failed;
+	}
+	return TRUE;
+
+failed:
+	TRACE_ERROR("Unable to apply the %s tuning profile, error: %s\n", t->name, strerror(errno));
+	return FALSE;
+}
@@ -0,0 +1,53 @@
+#ifndef TUNE_H_
+#define TUNE_H_
+
+#include <stddef.h>
+
+#define MAX_PROFILES (64)
+#define PROFILE_NAME_LEN (32)
+
+// Socket and protocol settings applied to a socket before it listens or
+// connects, the associations on it inherit them. -1 leaves a setting at
+// what the kernel or the command line gives.
+typedef struct tune {
+	char name[PROFILE_NAME_LEN];
+	// SO_SNDBUF and SO_RCVBUF in bytes, the kernel doubles them and caps
+	// them at net.core.wmem_max and rmem_max
+	int sndbuf;
+	int rcvbuf;
+	// SCTP_NODELAY, 1 turns off the bundling of small messages
+	int nodelay;
+	// SCTP_MAXSEG, largest DATA chunk in bytes
+	int maxseg;
+	// SCTP_DELAYED_SACK, milliseconds a SACK may wait and the number of
+	// packets after which it is sent anyway, 1 acks every packet
+	int sack_delay;
+	int sack_freq;
+	// SCTP_RTOINFO in milliseconds
+	int rto_initial;
+	int rto_min;
+	int rto_max;
+	// Queue of the listening socket and streams per association, -s on
+	// the command line wins over the latter
+	int backlog;
+	int streams;
+} tune_t;
+
+// Profile everything is tuned with, "default" leaves it all alone
+extern tune_t tuning;
+
+// Adds the profiles of a config file to the built-in ones, replacing
+// those with the same name. Every profile starts with [name] on a line
+// of its own, followed by lines of <setting> = <value>, # starts a
+// comment. Returns FALSE on the first line that doesn't parse.
+int tune_load(const char *path);
+
+// Copies the profile called name into t, FALSE if there is none
+int tune_select(const char *name, tune_t *t);
+
+// Human readable form of the settings the profile changes
+void tune_describe(const tune_t *t, char *buf, size_t len);
+
+int tune_apply(int sockid, const tune_t *t);
+
+#endif /* TUNE_H_ */
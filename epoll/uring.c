@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "uring.h"
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+							unsigned int flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t *u, unsigned int entries) {
+	struct io_uring_params p;
+
+	memset(u, 0, sizeof(uring_t));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+
+	u->fd = io_uring_setup(entries, &p);
+	if (u->fd == -1 && errno == EINVAL) {
+		// Kernels before 6.0 don't know these flags, they only save a bit
+		// of task work so we can do without them
+		memset(&p, 0, sizeof(p));
+		u->fd = io_uring_setup(entries, &p);
+	}
+	if (u->fd == -1) return FALSE;
+
+	u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_size > u->sq_size) u->sq_size = u->cq_size;
+		u->cq_size = u->sq_size;
+	}
+
+	u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED) goto sq_failed;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else {
+		u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED) goto cq_failed;
+	}
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) goto sqes_failed;
+
+	u->sq_head = u->sq_ptr + p.sq_off.head;
+	u->sq_tail = u->sq_ptr + p.sq_off.tail;
+	u->sq_mask = u->sq_ptr + p.sq_off.ring_mask;
+	u->sq_array = u->sq_ptr + p.sq_off.array;
+	u->sq_entries = p.sq_entries;
+
+	u->cq_head = u->cq_ptr + p.cq_off.head;
+	u->cq_tail = u->cq_ptr + p.cq_off.tail;
+	u->cq_mask = u->cq_ptr + p.cq_off.ring_mask;
+	u->cqes = u->cq_ptr + p.cq_off.cqes;
+
+	// SQ entries always map to the SQE with the same index
+	for (unsigned int i = 0; i < u->sq_entries; i++) u->sq_array[i] = i;
+	return TRUE;
+
+sqes_failed:
+	if (u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_size);
+cq_failed:
+	munmap(u->sq_ptr, u->sq_size);
+sq_failed:
+	close(u->fd);
+	return FALSE;
+}
+
+void uring_exit(uring_t *u) {
+	munmap(u->sqes, u->sqes_size);
+	if (u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_size);
+	munmap(u->sq_ptr, u->sq_size);
+	close(u->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *u) {
+	unsigned int tail = *u->sq_tail + u->to_submit;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) return NULL;
+
+	sqe = &u->sqes[tail & *u->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	u->to_submit++;
+	return sqe;
+}
+
+int uring_submit_and_wait(uring_t *u, unsigned int wait_nr) {
+	int ret;
+	unsigned int submit = u->to_submit;
+
+	__atomic_store_n(u->sq_tail, *u->sq_tail + submit, __ATOMIC_RELEASE);
+	u->to_submit = 0;
+
+	u->enters++;
+	ret = io_uring_enter(u->fd, submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	if (ret == -1 && errno != EINTR) return FALSE;
+	return TRUE;
+}
+
+int uring_bufs_init(uring_t *u, uring_bufs_t *b, uint16_t bgid, unsigned int nr, size_t size) {
+	struct io_uring_buf_reg reg;
+
+	// The kernel wants a power of two number of entries
+	if (nr == 0 || (nr & (nr - 1)) != 0) return FALSE;
+
+	memset(b, 0, sizeof(uring_bufs_t));
+	b->nr = nr;
+	b->size = size;
+	b->bgid = bgid;
+
+	b->br_size = nr * sizeof(struct io_uring_buf);
+	b->br = mmap(NULL, b->br_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b->br == MAP_FAILED) return FALSE;
+
+	b->base = malloc(nr * size);
+	if (b->base == NULL) goto base_failed;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)b->br;
+	reg.ring_entries = nr;
+	reg.bgid = bgid;
+	if (io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) goto register_failed;
+
+	for (unsigned int i = 0; i < nr; i++) uring_buf_recycle(b, i);
+	return TRUE;
+
+register_failed:
+	free(b->base);
+base_failed:
+	munmap(b->br, b->br_size);
+	return FALSE;
+}
+
+void uring_bufs_exit(uring_bufs_t *b) {
+	free(b->base);
+	munmap(b->br, b->br_size);
+}
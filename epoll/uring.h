@@ -0,0 +1,145 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper on top of the raw syscalls, just what the echo
+// server and client need
+
+typedef struct uring {
+	int fd;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int sq_entries;
+	struct io_uring_sqe *sqes;
+	// SQEs handed out but not yet passed to the kernel
+	unsigned int to_submit;
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+
+	// Number of io_uring_enter calls, for the syscall accounting
+	size_t enters;
+} uring_t;
+
+// Ring of kernel provided receive buffers, the kernel picks one per
+// completion and returns its id in the CQE flags
+typedef struct uring_bufs {
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	uint8_t *base;
+	unsigned int nr;
+	size_t size;
+	uint16_t bgid;
+} uring_bufs_t;
+
+#define URING_BUF_ID(cqe) ((cqe)->flags >> IORING_CQE_BUFFER_SHIFT)
+
+int uring_init(uring_t *u, unsigned int entries);
+void uring_exit(uring_t *u);
+
+// Returns a zeroed SQE, or NULL if the submission queue is full
+struct io_uring_sqe *uring_get_sqe(uring_t *u);
+
+// Submits everything queued and waits for at least wait_nr completions
+int uring_submit_and_wait(uring_t *u, unsigned int wait_nr);
+
+// Returns the next completion, or NULL if there is none
+static inline struct io_uring_cqe *uring_peek_cqe(uring_t *u) {
+	unsigned int head = *u->cq_head;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+	return &u->cqes[head & *u->cq_mask];
+}
+
+static inline void uring_cqe_seen(uring_t *u) {
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_bufs_init(uring_t *u, uring_bufs_t *b, uint16_t bgid, unsigned int nr, size_t size);
+void uring_bufs_exit(uring_bufs_t *b);
+
+static inline uint8_t *uring_buf(uring_bufs_t *b, unsigned int bid) {
+	return b->base + (size_t)bid * b->size;
+}
+
+// Gives the buffer back to the kernel
+static inline void uring_buf_recycle(uring_bufs_t *b, unsigned int bid) {
+	uint16_t tail = b->br->tail;
+	struct io_uring_buf *buf = &b->br->bufs[tail & (b->nr - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)uring_buf(b, bid);
+	buf->len = b->size;
+	buf->bid = bid;
+	__atomic_store_n(&b->br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd) {
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+static inline void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len) {
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+static inline void uring_prep_recv(struct io_uring_sqe *sqe, int fd, void *buf, size_t len) {
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+}
+
+static inline void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg) {
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+static inline void uring_prep_poll_add(struct io_uring_sqe *sqe, int fd, unsigned int events) {
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+}
+
+// Keeps receiving into buffers of the given group until it fails
+static inline void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint16_t bgid) {
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = bgid;
+}
+
+// Same as above, but every buffer starts with a struct io_uring_recvmsg_out
+// followed by the name and control data, as much as msg leaves room for
+static inline void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd,
+												struct msghdr *msg, uint16_t bgid) {
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = bgid;
+}
+
+#endif /* URING_H_ */
@@ -0,0 +1,441 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "server.h"
+#include "uring.h"
+
+#define URING_ENTRIES (1024)
+// Receive buffers shared by every connection, has to be a power of two
+#define URING_BUFS (4096)
+#define URING_BGID (0)
+
+// The sndrcvinfo of every message is received with it and sent back with
+// its echo to keep it on the same stream
+#define SINFO_CTRL_SIZE (CMSG_SPACE(sizeof(struct sctp_sndrcvinfo)))
+// Room in front of the payload of every receive buffer
+#define RECV_HDR_SIZE (sizeof(struct io_uring_recvmsg_out) + SINFO_CTRL_SIZE)
+
+// The operation is kept in the low bits of the user data, the rest is the
+// connection it belongs to
+#define OP_ACCEPT (0)
+#define OP_RECV (1)
+#define OP_SEND (2)
+#define OP_MASK (3)
+
+#define NO_BUF (-1)
+
+typedef struct uconn {
+	int sockid;
+	// FALSE once the multishot recv terminated
+	int recv_armed;
+	// The peer went away, free the connection once the send in flight is done
+	int closing;
+	// Received buffers waiting to be echoed, chained through buf_next. Only
+	// the head is in flight, so the echoes leave in the order they came in.
+	int send_head, send_tail;
+
+	// The sendmsg in flight
+	struct msghdr smsg;
+	struct iovec siov;
+	union {
+		char buf[SINFO_CTRL_SIZE];
+		struct cmsghdr align;
+	} sctrl;
+
+	struct uconn *prev, *next;
+	// Connections whose recv ran out of buffers and has to be re-armed
+	struct uconn *starved_next;
+	int starved;
+
+	// Messages larger than a receive buffer come in pieces, they are put
+	// back together so the echo is one message again
+	reasm_t reasm;
+} uconn_t;
+
+static uring_t ring;
+static uring_bufs_t bufs;
+
+// Per buffer state of the send queues. The offsets count from the start of
+// the buffer, the payload starts after the recvmsg header.
+static int buf_next[URING_BUFS];
+static uint32_t buf_len[URING_BUFS];
+static uint32_t buf_off[URING_BUFS];
+static uint16_t buf_stream[URING_BUFS];
+// A reassembled message is echoed from its own buffer, of buf_len bytes
+// from the shared pool, the receive buffer only keeps its place in the
+// send queue
+static uint8_t *buf_msg[URING_BUFS];
+static size_t buf_cap[URING_BUFS];
+
+// Only tells the multishot recvmsg how much room to leave for the control
+// data, shared by every connection
+static struct msghdr recv_hdr = {
+	.msg_controllen = SINFO_CTRL_SIZE,
+};
+
+static uconn_t *uconns;
+static uconn_t *starved;
+
+static inline uint64_t user_data(uconn_t *c, int op) {
+	return (uint64_t)(uintptr_t)c | op;
+}
+
+static inline struct io_uring_sqe *get_sqe() {
+	struct io_uring_sqe *sqe;
+
+	// Make room by handing what we have so far to the kernel
+	while ((sqe = uring_get_sqe(&ring)) == NULL) uring_submit_and_wait(&ring, 0);
+	return sqe;
+}
+
+void arm_accept() {
+	struct io_uring_sqe *sqe = get_sqe();
+
+	uring_prep_accept_multishot(sqe, server_sock);
+	sqe->user_data = user_data(NULL, OP_ACCEPT);
+}
+
+void arm_recv(uconn_t *c) {
+	struct io_uring_sqe *sqe = get_sqe();
+
+	uring_prep_recvmsg_multishot(sqe, c->sockid, &recv_hdr, URING_BGID);
+	sqe->user_data = user_data(c, OP_RECV);
+	c->recv_armed = TRUE;
+}
+
+void arm_send(uconn_t *c) {
+	int bid = c->send_head;
+	struct io_uring_sqe *sqe = get_sqe();
+	struct cmsghdr *cmsg;
+	struct sctp_sndrcvinfo sinfo;
+
+	c->siov.iov_base = (buf_msg[bid] ? buf_msg[bid] : uring_buf(&bufs, bid)) + buf_off[bid];
+	c->siov.iov_len = buf_len[bid] - buf_off[bid];
+	memset(&c->smsg, 0, sizeof(c->smsg));
+	c->smsg.msg_iov = &c->siov;
+	c->smsg.msg_iovlen = 1;
+	c->smsg.msg_control = c->sctrl.buf;
+	c->smsg.msg_controllen = sizeof(c->sctrl.buf);
+
+	memset(&sinfo, 0, sizeof(sinfo));
+	sinfo.sinfo_stream = buf_stream[bid];
+	policy_sinfo(&send_policy, &sinfo);
+	cmsg = CMSG_FIRSTHDR(&c->smsg);
+	cmsg->cmsg_level = IPPROTO_SCTP;
+	cmsg->cmsg_type = SCTP_SNDRCV;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(sinfo));
+	memcpy(CMSG_DATA(cmsg), &sinfo, sizeof(sinfo));
+
+	uring_prep_sendmsg(sqe, c->sockid, &c->smsg);
+	sqe->user_data = user_data(c, OP_SEND);
+}
+
+// Returns the stream the message in the receive buffer came in on
+uint16_t recv_stream(struct io_uring_recvmsg_out *out) {
+	struct msghdr ctl;
+	struct cmsghdr *cmsg;
+	struct sctp_sndrcvinfo sinfo;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.msg_control = (uint8_t *)(out + 1) + recv_hdr.msg_namelen;
+	ctl.msg_controllen = out->controllen;
+	for (cmsg = CMSG_FIRSTHDR(&ctl); cmsg; cmsg = CMSG_NXTHDR(&ctl, cmsg)) {
+		if (cmsg->cmsg_level != IPPROTO_SCTP || cmsg->cmsg_type != SCTP_SNDRCV) continue;
+		memcpy(&sinfo, CMSG_DATA(cmsg), sizeof(sinfo));
+		return sinfo.sinfo_stream;
+	}
+	return 0;
+}
+
+// Gives a buffer of the send queue back to the kernel, along with the
+// message it stood for
+void release_buf(int bid) {
+	if (buf_msg[bid]) {
+		bufpool_put(&shared_pool, buf_msg[bid], buf_cap[bid]);
+		buf_msg[bid] = NULL;
+	}
+	uring_buf_recycle(&bufs, bid);
+}
+
+void free_uconn(uconn_t *c) {
+	uconn_t **p = &starved;
+
+	if (c->starved) {
+		while (*p != c) p = &(*p)->starved_next;
+		*p = c->starved_next;
+	}
+
+	trace_event(TR_CLOSE, c->sockid, 0, -1, 0);
+	if (policy_partial(&send_policy)) get_abandoned(c->sockid, 0, &shared_stats.abandoned);
+	close(c->sockid);
+	reasm_clear(&c->reasm);
+	if (c->prev) c->prev->next = c->next;
+	else uconns = c->next;
+	if (c->next) c->next->prev = c->prev;
+	free(c);
+}
+
+// The recv is gone for good, drop whatever is not in flight yet and free
+// the connection as soon as nothing references it anymore
+void close_uconn(uconn_t *c) {
+	int bid;
+
+	c->closing = TRUE;
+	if (c->send_head == NO_BUF) {
+		free_uconn(c);
+		return;
+	}
+
+	bid = buf_next[c->send_head];
+	while (bid != NO_BUF) {
+		int next = buf_next[bid];
+		release_buf(bid);
+		bid = next;
+	}
+	buf_next[c->send_head] = NO_BUF;
+	c->send_tail = c->send_head;
+}
+
+void handle_accept(struct io_uring_cqe *cqe) {
+	uconn_t *c;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE) && !force_quit) arm_accept();
+	if (cqe->res < 0) {
+		TRACE_ERROR("Could not accept new connection, error: %s\n", strerror(-cqe->res));
+		return;
+	}
+	if (set_sched(cqe->res, 0, &stream_sched) == FALSE) {
+		close(cqe->res);
+		return;
+	}
+
+	c = calloc(1, sizeof(uconn_t));
+	if (c == NULL) {
+		TRACE_ERROR("Unable to allocate connection state\n");
+		close(cqe->res);
+		return;
+	}
+	c->sockid = cqe->res;
+	c->send_head = c->send_tail = NO_BUF;
+	c->reasm.pool = &shared_pool;
+	c->next = uconns;
+	if (uconns) uconns->prev = c;
+	uconns = c;
+
+	trace_event(TR_ACCEPT, c->sockid, 0, 0, 0);
+	arm_recv(c);
+}
+
+void handle_recv(uconn_t *c, struct io_uring_cqe *cqe) {
+	int bid;
+	uint16_t stream;
+	uint32_t off, len;
+	struct io_uring_recvmsg_out *out;
+	reasm_msg_t *m;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) c->recv_armed = FALSE;
+
+	if (cqe->res <= 0) {
+		if (cqe->res == -ENOBUFS) {
+			// Every buffer is waiting to be echoed, try again once some
+			// of them come back
+			if (!c->starved) {
+				c->starved = TRUE;
+				c->starved_next = starved;
+				starved = c;
+			}
+			return;
+		}
+		if (cqe->res == 0) {
+			TRACE_DEBUG("The connection closed from the client side\n");
+		} else {
+			TRACE_ERROR("An error occured while reading from client, error: %s\n",
+						strerror(-cqe->res));
+		}
+		if (!c->recv_armed) close_uconn(c);
+		return;
+	}
+
+	bid = URING_BUF_ID(cqe);
+	if (c->closing) {
+		uring_buf_recycle(&bufs, bid);
+		if (!c->recv_armed && c->send_head == NO_BUF) free_uconn(c);
+		return;
+	}
+	out = (struct io_uring_recvmsg_out *)uring_buf(&bufs, bid);
+	off = sizeof(*out) + recv_hdr.msg_namelen + recv_hdr.msg_controllen;
+	// Nothing to echo in an aborted partial delivery, but what arrived of
+	// its message goes
+	if (out->flags & MSG_NOTIFICATION) {
+		handle_pd_event(&c->reasm, (union sctp_notification *)(uring_buf(&bufs, bid) + off));
+		uring_buf_recycle(&bufs, bid);
+		if (!c->recv_armed) arm_recv(c);
+		return;
+	}
+	// A truncated message reports its full length
+	len = MIN(out->payloadlen, cqe->res - off);
+	stream = recv_stream(out);
+#ifdef RATE
+	if (shared_stats.io.rx == 0) shared_stats.rx_start_ts = shared_stats.now;
+#endif
+	count(&shared_stats.io.rx, len);
+#ifdef RATE
+	shared_stats.rx_end_ts = shared_stats.now;
+#endif
+	trace_event(TR_URING_READ, c->sockid, len, bid, stream);
+
+	if ((out->flags & MSG_EOR) && reasm_idle(&c->reasm)) {
+		buf_len[bid] = off + len;
+		buf_off[bid] = off;
+	} else {
+		if (reasm_add(&c->reasm, stream, uring_buf(&bufs, bid) + off, len,
+					  out->flags & MSG_EOR, &m) == FALSE) {
+			TRACE_ERROR("Unable to put a message of connection %d together\n", c->sockid);
+			uring_buf_recycle(&bufs, bid);
+			// The shutdown makes the multishot recv terminate
+			c->closing = TRUE;
+			shutdown(c->sockid, SHUT_RDWR);
+			if (!c->recv_armed) close_uconn(c);
+			return;
+		}
+		if (m == NULL) {
+			uring_buf_recycle(&bufs, bid);
+			if (!c->recv_armed) arm_recv(c);
+			return;
+		}
+		buf_msg[bid] = m->buf;
+		buf_cap[bid] = m->cap;
+		buf_len[bid] = m->len;
+		buf_off[bid] = 0;
+		reasm_done(&c->reasm, m);
+	}
+	count(&shared_stats.io.msgs, 1);
+
+	buf_stream[bid] = stream;
+	buf_next[bid] = NO_BUF;
+	if (c->send_head == NO_BUF) {
+		c->send_head = c->send_tail = bid;
+		arm_send(c);
+	} else {
+		buf_next[c->send_tail] = bid;
+		c->send_tail = bid;
+	}
+
+	// A multishot recv can still stop on its own, e.g. on an overflown CQ
+	if (!c->recv_armed && !c->closing) arm_recv(c);
+}
+
+void handle_send(uconn_t *c, struct io_uring_cqe *cqe) {
+	int bid = c->send_head;
+
+	if (cqe->res < 0) {
+		TRACE_ERROR("An error occur red while writing to client, error: %s\n",
+					strerror(-cqe->res));
+		// Whatever is left in the queue is dropped by close_uconn, and the
+		// shutdown makes the multishot recv terminate
+		if (!c->closing) {
+			close_uconn(c);
+			shutdown(c->sockid, SHUT_RDWR);
+		}
+		buf_off[bid] = buf_len[bid];
+	} else {
+#ifdef RATE
+		if (shared_stats.io.tx == 0) shared_stats.tx_start_ts = shared_stats.now;
+#endif
+		count(&shared_stats.io.tx, cqe->res);
+#ifdef RATE
+		shared_stats.tx_end_ts = shared_stats.now;
+#endif
+		buf_off[bid] += cqe->res;
+		if (buf_off[bid] < buf_len[bid]) {
+			arm_send(c);
+			return;
+		}
+	}
+
+	c->send_head = buf_next[bid];
+	release_buf(bid);
+	if (c->send_head != NO_BUF) {
+		arm_send(c);
+	} else {
+		c->send_tail = NO_BUF;
+		if (c->closing && !c->recv_armed) free_uconn(c);
+	}
+}
+
+void rearm_starved() {
+	uconn_t *c;
+
+	while (starved) {
+		c = starved;
+		starved = c->starved_next;
+		c->starved = FALSE;
+		if (!c->recv_armed && !c->closing) arm_recv(c);
+	}
+}
+
+int init_uring_server() {
+	if (uring_init(&ring, URING_ENTRIES) == FALSE) {
+		TRACE_ERROR("Unable to set up io_uring, error: %s\n", strerror(errno));
+		return FALSE;
+	}
+	if (uring_bufs_init(&ring, &bufs, URING_BGID, URING_BUFS, RECV_HDR_SIZE + MAX_BUFF) == FALSE) {
+		TRACE_ERROR("Unable to register io_uring buffers, error: %s\n", strerror(errno));
+		uring_exit(&ring);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void run_uring_server() {
+	int seen;
+	uint64_t ud;
+	uconn_t *c;
+	struct io_uring_cqe *cqe;
+
+	TRACE_INFO("Serving all associations on io_uring\n");
+	arm_accept();
+	while (!force_quit) {
+		if (uring_submit_and_wait(&ring, 1) == FALSE) {
+			TRACE_ERROR("io_uring_enter failed, error: %s\n", strerror(errno));
+			break;
+		}
+		trace_poll();
+
+#ifdef RATE
+		shared_stats.now = nano_ts();
+#endif
+		seen = 0;
+		while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+			ud = cqe->user_data;
+			c = (uconn_t *)(uintptr_t)(ud & ~(uint64_t)OP_MASK);
+			switch (ud & OP_MASK) {
+				case OP_ACCEPT:
+					handle_accept(cqe);
+					break;
+				case OP_RECV:
+					handle_recv(c, cqe);
+					break;
+				case OP_SEND:
+					handle_send(c, cqe);
+					break;
+			}
+			uring_cqe_seen(&ring);
+			seen++;
+		}
+		if (seen) shared_stats.wakeups++;
+		if (starved) rearm_starved();
+	}
+
+	shared_stats.waits = ring.enters;
+	while (uconns) free_uconn(uconns);
+	for (int bid = 0; bid < URING_BUFS; bid++) {
+		if (buf_msg[bid]) bufpool_put(&shared_pool, buf_msg[bid], buf_cap[bid]);
+	}
+	bufpool_destroy(&shared_pool);
+	uring_bufs_exit(&bufs);
+	uring_exit(&ring);
+}